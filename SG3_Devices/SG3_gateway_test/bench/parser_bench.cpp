@@ -0,0 +1,228 @@
+// Host-side micro-benchmark for the gateway serial command parser.
+//
+// Compares the old way (Arduino-style heap String, "+=" per byte, chain of == / startsWith)
+// with the fixed-buffer tokenizer + switch dispatch in src/command_parser.cpp.
+// Absolute numbers are PC numbers, not Uno numbers; the ratio is what matters.
+//
+// Build and run (from SG3_gateway_test/):
+//   g++ -O2 -std=c++11 -Isrc bench/parser_bench.cpp src/command_parser.cpp -o parser_bench
+//   ./parser_bench
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "command_parser.h"
+
+// ================= OLD PARSER (before) =================
+// Minimal copy of Arduino's String behaviour that matters here: the buffer is
+// realloc'ed to the exact size on every append, and substring() makes a new heap copy.
+class LegacyString {
+public:
+  LegacyString() : buf(nullptr), len(0) {}
+  LegacyString(const char* s, unsigned n) : buf(nullptr), len(0) { assign(s, n); }
+  LegacyString(const LegacyString& o) : buf(nullptr), len(0) { assign(o.buf ? o.buf : "", o.len); }
+  ~LegacyString() { free(buf); }
+
+  LegacyString& operator=(const LegacyString& o) {
+    if (this != &o) assign(o.buf ? o.buf : "", o.len);
+    return *this;
+  }
+  LegacyString& operator=(const char* s) {
+    assign(s, strlen(s));
+    return *this;
+  }
+  LegacyString& operator+=(char c) {
+    buf = (char*)realloc(buf, len + 2);
+    buf[len++] = c;
+    buf[len] = '\0';
+    return *this;
+  }
+
+  bool operator==(const char* s) const { return strcmp(c_str(), s) == 0; }
+  bool startsWith(const char* p) const { return strncmp(c_str(), p, strlen(p)) == 0; }
+  unsigned length() const { return len; }
+  const char* c_str() const { return buf ? buf : ""; }
+
+  int indexOf(char c) const {
+    const char* p = strchr(c_str(), c);
+    return p ? (int)(p - c_str()) : -1;
+  }
+  LegacyString substring(unsigned from) const { return substring(from, len); }
+  LegacyString substring(unsigned from, unsigned to) const {
+    if (to > len) to = len;
+    if (from > to) from = to;
+    return LegacyString(c_str() + from, to - from);
+  }
+
+private:
+  void assign(const char* s, unsigned n) {
+    buf = (char*)realloc(buf, n + 1);
+    memcpy(buf, s, n);
+    buf[n] = '\0';
+    len = n;
+  }
+
+  char* buf;
+  unsigned len;
+};
+
+static volatile unsigned long sink = 0;   // keeps the compiler from dropping the handlers
+static bool st_fanA, st_fanB, st_door, st_window, st_buzzer, st_white, st_orange;
+
+static void legacyDispatch(const LegacyString& serialBuf) {
+  if (serialBuf == "X") { st_fanA = !st_fanA; }
+  else if (serialBuf == "Y") { st_fanB = !st_fanB; }
+  else if (serialBuf == "D" || serialBuf == "D:1" || serialBuf == "D:0") {
+    if (serialBuf == "D:1") st_door = true;
+    else if (serialBuf == "D:0") st_door = false;
+    else st_door = !st_door;
+  }
+  else if (serialBuf == "N" || serialBuf == "N:1" || serialBuf == "N:0") {
+    if (serialBuf == "N:1") st_window = true;
+    else if (serialBuf == "N:0") st_window = false;
+    else st_window = !st_window;
+  }
+  else if (serialBuf == "B" || serialBuf == "B:1" || serialBuf == "B:0") {
+    if (serialBuf == "B:1") st_buzzer = true;
+    else if (serialBuf == "B:0") st_buzzer = false;
+    else st_buzzer = !st_buzzer;
+  }
+  else if (serialBuf == "W") { st_white = !st_white; }
+  else if (serialBuf == "O") { st_orange = !st_orange; }
+  else if (serialBuf == "SCHED?") { sink++; }
+  else if (serialBuf.startsWith("M")) {
+    LegacyString msg = serialBuf.substring(1);
+    LegacyString line1 = msg;
+    LegacyString line2;
+    int sep = msg.indexOf('|');
+    if (sep >= 0) {
+      line1 = msg.substring(0, sep);
+      line2 = msg.substring(sep + 1);
+    }
+    if (line1.length() > 16) line1 = line1.substring(0, 16);
+    if (line2.length() > 16) line2 = line2.substring(0, 16);
+    sink += line1.length() + line2.length();
+  }
+}
+
+static unsigned long legacyRun(const char* stream, size_t n) {
+  LegacyString serialBuf;
+  unsigned long commands = 0;
+  for (size_t i = 0; i < n; i++) {
+    char c = stream[i];
+    if (c == '\r') continue;
+    if (c == '\n') {
+      if (serialBuf.length() > 0) {
+        legacyDispatch(serialBuf);
+        commands++;
+      }
+      serialBuf = "";
+    } else {
+      if (serialBuf.length() < 80) serialBuf += c;
+    }
+  }
+  return commands;
+}
+
+// ================= NEW PARSER (after) =================
+static bool switchArg(const Command& cmd, bool& state) {
+  if (!cmd.hasArg) { state = !state; return true; }
+  if (cmd.arg > 1) return false;
+  state = (cmd.arg == 1);
+  return true;
+}
+
+static void newDispatch(const Command& cmd) {
+  if (cmd.kind == CMD_WORD) {
+    if (cmdWordIs(cmd, "SCHED")) sink++;
+    return;
+  }
+  if (cmd.kind == CMD_TEXT) {
+    char line1[17], line2[17];
+    uint8_t n1 = 0, n2 = 0;
+    bool second = false;
+    for (uint8_t i = 0; i < cmd.textLen; i++) {
+      char c = cmd.text[i];
+      if (c == '|' && !second) { second = true; continue; }
+      if (!second && n1 < 16) line1[n1++] = c;
+      if (second && n2 < 16)  line2[n2++] = c;
+    }
+    line1[n1] = '\0';
+    line2[n2] = '\0';
+    sink += n1 + n2 + (unsigned char)line1[0] + (unsigned char)line2[0];
+    return;
+  }
+  if (cmd.kind != CMD_SHORT) return;
+
+  switch (cmd.op) {
+    case 'X': if (!cmd.hasArg) st_fanA = !st_fanA; break;
+    case 'Y': if (!cmd.hasArg) st_fanB = !st_fanB; break;
+    case 'D': switchArg(cmd, st_door); break;
+    case 'N': switchArg(cmd, st_window); break;
+    case 'B': switchArg(cmd, st_buzzer); break;
+    case 'W': if (!cmd.hasArg) st_white = !st_white; break;
+    case 'O': if (!cmd.hasArg) st_orange = !st_orange; break;
+    default: break;
+  }
+}
+
+static unsigned long newRun(const char* stream, size_t n) {
+  LineBuffer lb;
+  lineReset(lb);
+  unsigned long commands = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (lineFeed(lb, stream[i])) {
+      newDispatch(parseCommand(lb));
+      commands++;
+    }
+  }
+  return commands;
+}
+
+// ================= DRIVER =================
+// Roughly what the gateway sends: mostly single toggles/setters, some LCD text.
+static const char* const kMix[] = {
+  "X", "Y", "D:1", "D:0", "N:1", "N:0", "B:1", "B:0", "W", "O",
+  "D", "N", "B", "MHello|World", "MWelcome home|Door open", "SCHED?",
+};
+
+typedef unsigned long (*RunFn)(const char*, size_t);
+
+static double measure(RunFn run, const char* stream, size_t n, int rounds, unsigned long& commands) {
+  commands = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) commands += run(stream, n);
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return commands / seconds;
+}
+
+int main(int argc, char** argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+
+  // Build one input stream of 1000 commands, each terminated with "\r\n" like a serial monitor
+  static char stream[64 * 1024];
+  size_t n = 0;
+  size_t mixCount = sizeof(kMix) / sizeof(kMix[0]);
+  for (int i = 0; i < 1000; i++) {
+    const char* cmd = kMix[i % mixCount];
+    size_t len = strlen(cmd);
+    memcpy(stream + n, cmd, len);
+    n += len;
+    stream[n++] = '\r';
+    stream[n++] = '\n';
+  }
+
+  unsigned long legacyCmds = 0;
+  unsigned long newCmds = 0;
+  double legacyRate = measure(legacyRun, stream, n, rounds, legacyCmds);
+  double newRate = measure(newRun, stream, n, rounds, newCmds);
+
+  printf("commands per round : %d (%zu bytes)\n", 1000, n);
+  printf("before (String)    : %12.0f cmd/s  (%lu cmds)\n", legacyRate, legacyCmds);
+  printf("after  (LineBuffer): %12.0f cmd/s  (%lu cmds)\n", newRate, newCmds);
+  printf("speedup            : %12.2fx\n", newRate / legacyRate);
+  return 0;
+}
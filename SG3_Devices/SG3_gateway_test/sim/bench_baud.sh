@@ -0,0 +1,56 @@
+#!/bin/sh
+# Serial link benchmark on the simulator, one run per rate the board does (see BAUD in
+# main.cpp). Every run negotiates the rate like the gateway does, then measures:
+#   latency     20 toggles with a #<seq>, time from sending the line to the end of its ACK
+#               (both directions on the wire plus the pass that runs it)
+#               At 9600 most of it is the STATE line of the toggle before, still going out.
+#   throughput  the PERF? report (~1 KB), bytes of its lines / time until the last one is in
+# Usage: sim/bench_baud.sh [path to program]
+cd "$(dirname "$0")/.." || exit 1
+PROGRAM=${1:-.pio/build/native/program}
+TRACE=${TMPDIR:-/tmp}/bench_baud.trace
+OUT=${TMPDIR:-/tmp}/bench_baud.txt
+
+printf "%-8s %10s %10s %12s %8s\n" rate avg_ms max_ms report_B/s lines
+for rate in 9600 57600 115200 250000; do
+  {
+    echo "0      A0 30"
+    if [ "$rate" = 9600 ]; then
+      echo "1000   EXPECT baud 9600"
+    else
+      echo "1000   SEND BAUD $rate#1"
+      echo "+70    BAUD $rate"
+      echo "+10    SEND"
+      echo "+0     SEND BAUD?"
+      echo "+50    EXPECT baud $rate"
+    fi
+    seq=2
+    while [ $seq -le 21 ]; do
+      echo "+100   SEND W#$seq"
+      seq=$((seq + 1))
+    done
+    echo "+300   SEND PERF?"
+    echo "+3000  END"
+  } > "$TRACE"
+
+  if ! "$PROGRAM" "$TRACE" > "$OUT"; then
+    echo "$rate: run failed"
+    grep FAIL "$OUT"
+    exit 1
+  fi
+
+  awk -v rate="$rate" '
+    $2 == ">" && $3 == "send" && $4 ~ /^W#/ { split($4, p, "#"); sent[p[2]] = $1 }
+    $2 == "serial" && $3 == "ACK" && ($4 in sent) {
+      d = $1 - sent[$4]; n++; sum += d; if (d > max) max = d
+    }
+    $2 == ">" && $3 == "send" && $4 == "PERF?" { reportStart = $1 }
+    reportStart && $2 == "serial" && ($3 == "PERF" || $3 == "PERF%") {
+      line = $0; sub(/^ *[0-9.]+ +serial +/, "", line)
+      bytes += length(line) + 2; last = $1; lines++
+    }
+    END {
+      bps = last > reportStart ? bytes * 1000 / (last - reportStart) : 0
+      printf "%-8s %10.1f %10.1f %12.0f %8d\n", rate, n ? sum / n : 0, max, bps, lines
+    }' "$OUT"
+done
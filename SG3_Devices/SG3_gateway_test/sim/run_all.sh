@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs every trace in this folder through the native build (pio run -e native) and
+# fails if any EXPECT line failed. Usage: sim/run_all.sh [path to program]
+#
+# Every trace starts with an erased EEPROM, except <name>.reboot.trace: it runs after
+# <name>.trace with the EEPROM that one left behind (the board after a reset).
+cd "$(dirname "$0")/.." || exit 1
+PROGRAM=${1:-.pio/build/native/program}
+EEPROM_DIR=${TMPDIR:-/tmp}
+
+failed=0
+run() {
+  trace=$1
+  base=$(basename "$trace" .trace)
+  image="$EEPROM_DIR/sim_eeprom_${base%.reboot}.bin"
+  case "$trace" in
+    *.reboot.trace) ;;
+    *) rm -f "$image" ;;
+  esac
+
+  if "$PROGRAM" -q -e "$image" "$trace" > /tmp/sim_out.txt; then
+    echo "ok    $trace  ($(tail -n 1 /tmp/sim_out.txt | sed 's/.*(\(.*\))/\1/'))"
+  else
+    echo "FAIL  $trace"
+    grep "FAIL" /tmp/sim_out.txt
+    failed=1
+  fi
+}
+
+for trace in sim/*.trace; do
+  case "$trace" in *.reboot.trace) continue ;; esac
+  run "$trace"
+done
+for trace in sim/*.reboot.trace; do
+  [ -e "$trace" ] && run "$trace"
+done
+exit $failed
@@ -0,0 +1,226 @@
+"""Compiles automation rules to the Arduino rule bytecode and uploads them over serial.
+
+One rule per line, '#' starts a comment:
+
+    when gas > 60 for 2000 -> set fan_ina on; lcd "Gas rising|fan on"
+    while motion and not orange -> set orange on
+
+'when' runs the actions once each time the condition becomes true, 'while' runs them
+every tick (20 ms) as long as it is true. 'for <ms>' = true for that long without a break.
+Sensors: gas light soil steam motion. Actuators: door window fan_ina fan_inb white orange buzzer.
+Format and limits: see rules.h in the firmware.
+
+    python rules_asm.py rules.txt            upload (SERIAL_PORT / SERIAL_BAUD from config/.env)
+    python rules_asm.py rules.txt --print    only print the R= lines
+    python rules_asm.py --clear              remove all rules
+"""
+import re, sys, time
+
+OP_K16, OP_SEN, OP_ACT = 0x01, 0x02, 0x03
+OP_GT, OP_LT, OP_EQ, OP_AND, OP_OR, OP_NOT = 0x04, 0x05, 0x06, 0x07, 0x08, 0x09
+OP_HELD, OP_THEN, OP_SET, OP_LCD = 0x0A, 0x10, 0x20, 0x21
+RULE_EDGE = 0x01
+
+SENSORS = ["gas", "light", "soil", "steam", "motion"]
+ACTUATORS = ["door", "window", "fan_ina", "fan_inb", "white", "orange", "buzzer"]
+
+CODE_MAX = 125
+LCD_MAX = 33
+BYTES_PER_LINE = 38   # "R=" + 76 hex digits fits the 80 char command line
+
+TOKEN = re.compile(r'\s*(?:(\d+)|("[^"]*")|(->|>=|<=|==|[<>();])|([a-z_]+))')
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def tokenize(text):
+    tokens, pos = [], 0
+    text = text.rstrip()
+    while pos < len(text):
+        m = TOKEN.match(text, pos)
+        if not m:
+            raise ValueError(f"cannot read '{text[pos:]}'")
+        tokens.append(next(t for t in m.groups() if t is not None))
+        pos = m.end()
+    return tokens
+
+
+class Rule:
+    def __init__(self, tokens):
+        self.t = tokens
+        self.i = 0
+        self.code = []
+
+    def peek(self):
+        return self.t[self.i] if self.i < len(self.t) else None
+
+    def take(self, expected=None):
+        tok = self.peek()
+        if tok is None or (expected and tok != expected):
+            raise ValueError(f"expected {expected or 'more'}, got {tok}")
+        self.i += 1
+        return tok
+
+    def number(self):
+        tok = self.take()
+        if not tok.isdigit() or int(tok) > 32767:
+            raise ValueError(f"bad number {tok}")
+        return int(tok)
+
+    def atom(self):
+        tok = self.take()
+        if tok == "(":
+            self.or_expr()
+            self.take(")")
+        elif tok.isdigit():
+            self.code += [OP_K16, int(tok) & 0xFF, int(tok) >> 8]
+        elif tok in SENSORS:
+            self.code += [OP_SEN, SENSORS.index(tok)]
+        elif tok in ACTUATORS:
+            self.code += [OP_ACT, ACTUATORS.index(tok)]
+        else:
+            raise ValueError(f"unknown name {tok}")
+
+    def compare(self):
+        self.atom()
+        op = self.peek()
+        if op in (">", "<", "==", ">=", "<="):
+            self.take()
+            self.atom()
+            self.code += {">": [OP_GT], "<": [OP_LT], "==": [OP_EQ],
+                          ">=": [OP_LT, OP_NOT], "<=": [OP_GT, OP_NOT]}[op]
+
+    def unary(self):
+        if self.peek() == "not":
+            self.take()
+            self.unary()
+            self.code.append(OP_NOT)
+        else:
+            self.compare()
+
+    def and_expr(self):
+        self.unary()
+        while self.peek() == "and":
+            self.take()
+            self.unary()
+            self.code.append(OP_AND)
+
+    def or_expr(self):
+        self.and_expr()
+        while self.peek() == "or":
+            self.take()
+            self.and_expr()
+            self.code.append(OP_OR)
+
+    def action(self):
+        tok = self.take()
+        if tok == "set":
+            name = self.take()
+            if name not in ACTUATORS:
+                raise ValueError(f"unknown actuator {name}")
+            value = self.take()
+            if value not in ("on", "off", "open", "close"):
+                raise ValueError(f"set {name} needs on/off, got {value}")
+            self.code += [OP_SET, ACTUATORS.index(name), 1 if value in ("on", "open") else 0]
+        elif tok == "lcd":
+            text = self.take()
+            if not text.startswith('"'):
+                raise ValueError("lcd needs a quoted text")
+            raw = text[1:-1].encode("ascii")
+            if len(raw) > LCD_MAX:
+                raise ValueError(f"lcd text longer than {LCD_MAX}")
+            self.code += [OP_LCD, len(raw)] + list(raw)
+        else:
+            raise ValueError(f"unknown action {tok}")
+
+    def compile(self):
+        kind = self.take()
+        if kind not in ("when", "while"):
+            raise ValueError("a rule starts with 'when' or 'while'")
+        self.or_expr()
+        if self.peek() == "for":
+            self.take()
+            ms = self.number()
+            self.code += [OP_HELD, ms & 0xFF, ms >> 8]
+        self.take("->")
+        self.code.append(OP_THEN)
+        self.action()
+        while self.peek() == ";":
+            self.take()
+            self.action()
+        if self.peek() is not None:
+            raise ValueError(f"unexpected {self.peek()}")
+        body = [RULE_EDGE if kind == "when" else 0] + self.code
+        return [len(body)] + body
+
+
+def compile_rules(text):
+    program = []
+    for n, line in enumerate(text.splitlines(), 1):
+        line = line.split("#", 1)[0].strip()
+        if not line:
+            continue
+        try:
+            program += Rule(tokenize(line)).compile()
+        except ValueError as e:
+            raise ValueError(f"line {n}: {e}") from None
+    if len(program) > CODE_MAX:
+        raise ValueError(f"program is {len(program)} bytes, the board takes {CODE_MAX}")
+    return bytes(program)
+
+
+def upload_lines(program):
+    """Serial lines that replace the program on the board."""
+    lines = ["RULE!"]
+    for i in range(0, len(program), BYTES_PER_LINE):
+        lines.append("R=" + program[i:i + BYTES_PER_LINE].hex().upper())
+    lines.append(f"R:{crc8(program)}")
+    return lines
+
+
+def upload(program):
+    from serial_client import SerialClient
+    sc = SerialClient()
+    # The board collects the R= lines in RAM, so they can go back to back. It answers R: as soon
+    # as the program checks out and writes the EEPROM in the background afterwards. The old
+    # program keeps running until then, and stays if the upload fails. RULE! right after an
+    # upload may answer "RULE busy" (the last save is still running): that is a failed upload,
+    # try again in a second.
+    for line in upload_lines(program):
+        sc.send_line(line)
+    deadline = time.time() + 5
+    while time.time() < deadline:
+        msg = sc.read_message()
+        if msg and msg[0] == "line" and msg[1].startswith("RULE "):
+            print(msg[1])
+            if not msg[1].startswith("RULE load"):
+                return msg[1].startswith("RULE ok")
+    print("no answer from the board")
+    return False
+
+
+def main(argv):
+    if argv[1:] == ["--clear"]:
+        program = b""
+    elif len(argv) >= 2:
+        with open(argv[1]) as f:
+            program = compile_rules(f.read())
+    else:
+        print(__doc__)
+        return 1
+
+    if "--print" in argv:
+        print("\n".join(upload_lines(program)))
+        return 0
+    return 0 if upload(program) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -1,5 +1,6 @@
-import os, time, serial
-from threading import Lock
+import os, random, time, serial
+from collections import deque
+from threading import Condition, Lock
 from dotenv import load_dotenv
 
 # Get the directory containing this script
@@ -9,24 +10,248 @@ PROJECT_ROOT = os.path.dirname(SCRIPT_DIR)  # smarthouse-gateway directory
 load_dotenv(os.path.join(PROJECT_ROOT, "config/.env"))
 
 PORT = os.getenv("SERIAL_PORT", "COM3")
-BAUD = int(os.getenv("SERIAL_BAUD","9600"))
+BOOT_BAUD = 9600   # the board always comes up at 9600
+BAUD = int(os.getenv("SERIAL_BAUD","9600"))   # rate to negotiate once it is up (9600, 57600, 115200, 250000)
+
+# send_command(): how long to wait for ACK/NAK before sending again, and how often to try
+ACK_TIMEOUT = float(os.getenv("ACK_TIMEOUT", "0.3"))
+ACK_TRIES = int(os.getenv("ACK_TRIES", "3"))
+BACKLOG_MAX = 64   # unread board messages kept for read_message(), oldest dropped first
+
+# negotiate_baud(): wait per "BAUD?" probe, number of probes, and how long the board may take
+# to fall back to 9600 by itself (it gives up 1 s after switching)
+PROBE_TIMEOUT = 0.2
+PROBE_TRIES = 3
+FALLBACK_WAIT = 1.5
 
 
 
 class SerialClient:
     def __init__(self):
-        self.ser = serial.Serial(PORT,BAUD, timeout= 1)
+        # Short read timeout, so send_command() can notice a missing ACK quickly
+        self.ser = serial.Serial(PORT,BOOT_BAUD, timeout= 0.05)
         self._write_lock = Lock()
-        time.sleep(2)
+        self._read_lock = Lock()
+        self._rx = bytearray()
+        self._in_frame = False
+        self._frame = bytearray()
+        self._line = bytearray()
+        self._backlog = deque(maxlen=BACKLOG_MAX)   # messages read while waiting for an ACK, for read_message()
+
+        # Command acknowledgements (see send_command)
+        self._cmd_lock = Lock()
+        self._answer_cv = Condition()
+        self._waiting_seq = None
+        self._answer = None
+        self._seq = random.randint(0, 65534)   # a restarted gateway shouldn't repeat the last seq
+        self.stats = {"sent": 0, "acked": 0, "nak": 0, "retries": 0, "lost": 0}
+        self.latency = deque(maxlen=100)       # (round trip ms, device rx->applied us) per ACK
+
+        self._wait_for_board()
+        if BAUD != BOOT_BAUD:
+            print(f"Serial link at {self.negotiate_baud(BAUD)} baud")
+
+    def _wait_for_board(self, timeout=2.0):
+        """Opening the port resets the Arduino. Instead of always sleeping 2 s, wait until it
+        sends its first bytes: the firmware takes commands a few ms after the bootloader hands
+        over (BOOT line), the bytes stay in the buffer for read_message()."""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            chunk = self.ser.read(self.ser.in_waiting or 1)
+            if chunk:
+                self._rx.extend(chunk)
+                return True
+        return False
+
+    def negotiate_baud(self, rate):
+        """BAUD handshake (see SERIAL LINK SPEED in main.cpp). The board answers "BAUD switch <rate>"
+        and the ACK on the old rate and switches once they are out; then a "BAUD?" probe on the new rate
+        has to be answered with "BAUD <rate>". If no probe gets through, the board goes back to
+        9600 by itself and so do we. Returns the rate the link runs at afterwards."""
+        answer = self.send_command(f"BAUD {rate}")
+        if answer is None or not answer["ok"]:
+            return self.ser.baudrate
+        time.sleep(0.02)   # the board switches right after the last byte of the ACK
+
+        self._set_baud(rate)
+        if self._probe(rate):
+            return rate
+
+        self._set_baud(BOOT_BAUD)
+        if self._wait_line(f"BAUD fallback {BOOT_BAUD}", time.time() + FALLBACK_WAIT) or self._probe(BOOT_BAUD):
+            return BOOT_BAUD
+        # Silent on 9600 too: a probe got through after all and only its answer was lost
+        self._set_baud(rate)
+        return rate if self._probe(rate) else BOOT_BAUD
+
+    def _set_baud(self, rate):
+        """Changes our side of the link. Whatever was half-read is junk from the switch."""
+        with self._read_lock:
+            self.ser.baudrate = rate
+            self.ser.reset_input_buffer()
+            self._rx = bytearray()
+            self._line = bytearray()
+            self._in_frame = False
+
+    def _probe(self, rate):
+        for _ in range(PROBE_TRIES):
+            self.send_line("\nBAUD?")   # the newline ends any junk the board got during the switch
+            if self._wait_line(f"BAUD {rate}", time.time() + PROBE_TIMEOUT):
+                return True
+        return False
+
+    def _wait_line(self, text, deadline):
+        """Reads until the line text arrives; everything else stays for read_message()."""
+        with self._read_lock:
+            while time.time() < deadline:
+                msg = self._read_message()
+                if msg == ("line", text):
+                    return True
+                if msg is not None:
+                    self._backlog.append(msg)
+        return False
 
     def send_line(self, line: str):
         with self._write_lock:
             self.ser.write((line + "\n").encode("utf-8"))
             self.ser.flush()
 
+    def send_text(self, line1: str, line2: str = ""):
+        """Show two lines on the LCD. The board takes a text line as is (a #<seq> would end up
+        on the display), so there is no ACK to wait for."""
+        self.send_line(f"M{line1[:16]}|{line2[:16]}")
+
+    def send_command(self, line: str):
+        """Send a command with a #<seq> suffix and wait until the board answers.
+        The board replies "ACK <seq> <rx_us> <applied_us>" once the outputs are written, or
+        "NAK <seq> <reason>". Without an answer within ACK_TIMEOUT the same line (same seq) is
+        sent again; the board runs it only once, even if it was just the ACK that got lost.
+        ACK means accepted, not finished: a door or window servo is only starting to move then
+        and needs up to about a second more to get there (nothing reports when it has).
+        Returns a dict with ok/reason/rtt_ms/device_us/tries, or None if all tries failed."""
+        with self._cmd_lock:
+            self._seq = (self._seq + 1) % 65536
+            seq = self._seq
+            with self._answer_cv:
+                self._waiting_seq = seq
+                self._answer = None
+
+            for tries in range(1, ACK_TRIES + 1):
+                sent = time.time()
+                self.send_line(f"{line}#{seq}")
+                self.stats["sent"] += 1
+                answer = self._wait_answer(sent + ACK_TIMEOUT)
+                if answer is not None:
+                    break
+                self.stats["retries"] += 1
+
+            with self._answer_cv:
+                self._waiting_seq = None
+            if answer is None:
+                self.stats["retries"] -= 1   # the last timeout is a loss, not a retry
+                self.stats["lost"] += 1
+                return None
+
+            answer["tries"] = tries
+            answer["rtt_ms"] = (time.time() - sent) * 1000.0
+            if answer["ok"]:
+                self.stats["acked"] += 1
+                self.latency.append((answer["rtt_ms"], answer["device_us"]))
+            else:
+                self.stats["nak"] += 1
+            return answer
+
+    def latency_summary(self):
+        """One line about the last ACKs: round trip on the gateway and rx->applied on the board."""
+        if not self.latency:
+            return "no ACKs yet"
+        rtt = [r for r, _ in self.latency]
+        dev = [d for _, d in self.latency]
+        return (f"n={len(rtt)} rtt avg {sum(rtt) / len(rtt):.1f} ms max {max(rtt):.1f} ms, "
+                f"device avg {sum(dev) / len(dev):.0f} us max {max(dev)} us, "
+                f"retries {self.stats['retries']} lost {self.stats['lost']} nak {self.stats['nak']}")
+
+    def _wait_answer(self, deadline):
+        while True:
+            with self._answer_cv:
+                if self._answer is not None:
+                    return self._answer
+                left = deadline - time.time()
+                if left <= 0:
+                    return None
+            # Nobody else is reading (e.g. before the listener thread runs): read ourselves
+            if self._read_lock.acquire(blocking=False):
+                try:
+                    msg = self._read_message()
+                    if msg is not None:
+                        self._backlog.append(msg)
+                finally:
+                    self._read_lock.release()
+            else:
+                with self._answer_cv:
+                    if self._answer is None:
+                        self._answer_cv.wait(min(left, 0.05))
+
+    def _take_answer(self, line):
+        """ACK/NAK lines are handled here and never returned by read_message()."""
+        parts = line.split()
+        if len(parts) < 3 or parts[0] not in ("ACK", "NAK") or not parts[1].isdigit():
+            return False
+        seq = int(parts[1])
+        if parts[0] == "ACK":
+            if len(parts) != 4 or not parts[2].isdigit() or not parts[3].isdigit():
+                return False
+            answer = {"ok": True, "reason": None, "device_us": (int(parts[3]) - int(parts[2])) % (1 << 32)}
+        else:
+            answer = {"ok": False, "reason": parts[2], "device_us": None}
+        with self._answer_cv:
+            # Late or repeated answers for an older command are dropped
+            if seq == self._waiting_seq and self._answer is None:
+                self._answer = answer
+                self._answer_cv.notify_all()
+        return True
+
     def read_line(self):
         """Non-blocking read of one line from Arduino."""
         raw = self.ser.readline()
         if not raw:
             return ""
         return raw.decode("utf-8", errors="ignore").strip()
+
+    def read_message(self):
+        """Read one message from Arduino, ASCII lines and binary frames mixed.
+        Returns ("line", str), ("frame", bytes) or None if nothing (else) arrived.
+        Binary telemetry frames are sent as 0x00 <COBS bytes> 0x00, text lines end with newline.
+        ACK/NAK lines are not returned, they go to send_command()."""
+        with self._read_lock:
+            if self._backlog:
+                return self._backlog.popleft()
+            return self._read_message()
+
+    def _read_message(self):
+        while True:
+            while self._rx:
+                b = self._rx.pop(0)
+                if b == 0:
+                    if self._in_frame and self._frame:
+                        self._in_frame = False
+                        return ("frame", bytes(self._frame))
+                    # Start of a frame (or an empty one between two frames)
+                    self._in_frame = True
+                    self._frame = bytearray()
+                    self._line = bytearray()
+                elif self._in_frame:
+                    self._frame.append(b)
+                elif b == 0x0A:
+                    line = bytes(self._line).decode("utf-8", errors="ignore").strip()
+                    self._line = bytearray()
+                    if line:
+                        # An ACK/NAK ends the read too, so send_command() sees it right away
+                        return None if self._take_answer(line) else ("line", line)
+                else:
+                    self._line.append(b)
+
+            chunk = self.ser.read(self.ser.in_waiting or 1)
+            if not chunk:
+                return None
+            self._rx.extend(chunk)
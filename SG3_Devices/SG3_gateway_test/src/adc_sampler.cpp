@@ -0,0 +1,77 @@
+#include "adc_sampler.h"
+
+// Written by the ISR
+static volatile uint16_t adcRing[ADC_CHANNELS][ADC_MEDIAN_N];
+static volatile uint8_t adcRingHead[ADC_CHANNELS];
+static volatile uint8_t adcRingFill[ADC_CHANNELS];
+static volatile uint8_t adcNewSamples[ADC_CHANNELS];
+static volatile uint16_t adcSum[ADC_CHANNELS];
+static volatile uint8_t adcSumCount[ADC_CHANNELS];
+
+// Owned by the main loop
+static int16_t adcEwma[ADC_CHANNELS];   // Q4 fixed point (value * 16)
+static bool adcEwmaSeeded[ADC_CHANNELS];
+
+// Adds one raw conversion result for a channel (called from the ADC interrupt, see hal.h)
+static void adcAddSample(uint8_t ch, uint16_t v) {
+  adcSum[ch] += v;
+  if (++adcSumCount[ch] < ADC_DECIMATE) return;
+
+  uint8_t head = adcRingHead[ch];
+  adcRing[ch][head] = adcSum[ch] / ADC_DECIMATE;
+  adcRingHead[ch] = (uint8_t)((head + 1) % ADC_MEDIAN_N);
+  if (adcRingFill[ch] < ADC_MEDIAN_N) adcRingFill[ch]++;
+  if (adcNewSamples[ch] < 255) adcNewSamples[ch]++;
+
+  adcSum[ch] = 0;
+  adcSumCount[ch] = 0;
+}
+
+void adcBegin() {
+  halAdcStart(ADC_CHANNELS, adcAddSample);
+}
+
+// Median of up to ADC_MEDIAN_N values (insertion sort, n is tiny)
+static uint16_t median(uint16_t* v, uint8_t n) {
+  for (uint8_t i = 1; i < n; i++) {
+    uint16_t x = v[i];
+    uint8_t j = i;
+    while (j > 0 && v[j - 1] > x) {
+      v[j] = v[j - 1];
+      j--;
+    }
+    v[j] = x;
+  }
+  return v[n / 2];
+}
+
+void adcUpdate() {
+  for (uint8_t ch = 0; ch < ADC_CHANNELS; ch++) {
+    uint16_t window[ADC_MEDIAN_N];
+    uint8_t fill;
+
+    // Copy the ring with interrupts off so the ISR can't change it halfway
+    halInterruptsOff();
+    if (adcNewSamples[ch] == 0) {
+      halInterruptsOn();
+      continue;
+    }
+    adcNewSamples[ch] = 0;
+    fill = adcRingFill[ch];
+    for (uint8_t i = 0; i < fill; i++) window[i] = adcRing[ch][i];
+    halInterruptsOn();
+
+    int16_t med = (int16_t)(median(window, fill) << 4);
+    if (!adcEwmaSeeded[ch]) {
+      adcEwma[ch] = med;
+      adcEwmaSeeded[ch] = true;
+    } else {
+      adcEwma[ch] += (int16_t)((med - adcEwma[ch]) >> ADC_EWMA_SHIFT);
+    }
+  }
+}
+
+int adcValue(uint8_t ch) {
+  if (ch >= ADC_CHANNELS) return 0;
+  return (adcEwma[ch] + 8) >> 4;   // round back from Q4
+}
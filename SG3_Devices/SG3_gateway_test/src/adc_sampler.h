@@ -0,0 +1,31 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= BACKGROUND ADC SAMPLING =================
+// Instead of four blocking analogRead() calls (~112 us each), the ADC runs on its own:
+// it is auto-triggered by the Timer0 overflow (the same ~1 kHz tick that drives millis()),
+// and the ADC interrupt stores the result and switches the multiplexer to the next channel.
+// So A0..A3 are each sampled ~244 times per second without the main loop waiting for anything.
+//
+// Filtering per channel:
+//   1) decimation: the ISR averages ADC_DECIMATE raw samples into one value (~61 Hz per channel)
+//   2) median of the last ADC_MEDIAN_N decimated values (kills single spikes)
+//   3) fixed-point EWMA on top of the median (smooths noise, alpha = 1 / 2^ADC_EWMA_SHIFT)
+// Steps 2 and 3 run in adcUpdate(), outside the interrupt.
+// The register setup and the interrupt itself live in the HAL (halAdcStart, see hal.h).
+
+const uint8_t ADC_CHANNELS = 4;    // A0 (gas), A1 (light), A2 (soil), A3 (steam)
+const uint8_t ADC_DECIMATE = 4;
+const uint8_t ADC_MEDIAN_N = 5;
+const uint8_t ADC_EWMA_SHIFT = 2;
+
+// Sets up the ADC and starts sampling in the background
+void adcBegin();
+
+// Filters whatever new samples arrived since the last call. Cheap, never waits on the ADC.
+void adcUpdate();
+
+// Latest filtered value (0..1023) of channel 0..3
+int adcValue(uint8_t ch);
@@ -0,0 +1,219 @@
+#include "command_parser.h"
+
+#include <string.h>
+
+#if defined(__AVR__)
+  #include <avr/pgmspace.h>
+#else
+  #define strlen_P strlen
+  #define memcmp_P memcmp
+#endif
+
+void lineReset(LineBuffer& lb) {
+  lb.len = 0;
+  lb.overflow = false;
+  lb.ready = false;
+  lb.buf[0] = '\0';
+}
+
+bool lineFeed(LineBuffer& lb, char c) {
+  if (c == '\r') return false;
+
+  // The previous call returned a finished line, start a new one
+  if (lb.ready) lineReset(lb);
+
+  if (c == '\n') {
+    // A line that did not fit is never run as a cut-off command (see CMD_TOO_LONG)
+    if (lb.len == 0) return false;
+    lb.ready = true;
+    return true;
+  }
+
+  if (lb.len < CMD_LINE_MAX) {
+    lb.buf[lb.len++] = c;
+    lb.buf[lb.len] = '\0';
+  } else {
+    // Keep sliding the last few bytes, so a #<seq> at the very end is still there
+    lb.overflow = true;
+    char* tail = lb.buf + CMD_LINE_MAX - CMD_SEQ_MAX;
+    memmove(tail, tail + 1, CMD_SEQ_MAX - 1);
+    lb.buf[CMD_LINE_MAX - 1] = c;
+  }
+  return false;
+}
+
+static bool isUpper(char c) {
+  return c >= 'A' && c <= 'Z';
+}
+
+// 0..15, or 0xFF if c is not a hex digit (upper case only, like everything else here)
+static uint8_t hexValue(char c) {
+  if (c >= '0' && c <= '9') return (uint8_t)(c - '0');
+  if (c >= 'A' && c <= 'F') return (uint8_t)(c - 'A' + 10);
+  return 0xFF;
+}
+
+// LCD text: 'M' and a '|' somewhere after it (the gateway always sends both lines)
+static bool isText(const char* line, uint8_t len) {
+  return len >= 2 && line[0] == 'M' && memchr(line + 1, '|', len - 1) != nullptr;
+}
+
+// Takes a #<seq> off the end of the line. Returns the length of what is left.
+static uint8_t stripSeq(const char* line, uint8_t len, Command& cmd) {
+  cmd.hasSeq = false;
+  cmd.seq = 0;
+  if (isText(line, len)) return len;   // text is shown as is, digits after a '#' included
+
+  uint8_t i = len;
+  uint32_t value = 0;
+  uint32_t scale = 1;
+  while (i > 0 && len - i < CMD_SEQ_MAX - 1 && line[i - 1] >= '0' && line[i - 1] <= '9') {
+    i--;
+    value += (uint32_t)(line[i] - '0') * scale;
+    scale *= 10;
+  }
+  if (i == len || i == 0 || line[i - 1] != '#' || value > 0xFFFF) return len;
+
+  cmd.hasSeq = true;
+  cmd.seq = (uint16_t)value;
+  return (uint8_t)(i - 1);
+}
+
+// Everything after the #<seq> / length checks: one command in line[0..len)
+static void parseBody(const char* line, uint8_t len, Command& cmd) {
+  cmd.kind = CMD_INVALID;
+  cmd.op = len > 0 ? line[0] : '\0';
+  cmd.hasArg = false;
+  cmd.arg = 0;
+  cmd.text = line;
+  cmd.textLen = 0;
+
+  if (len == 0) {
+    cmd.kind = CMD_EMPTY;
+    return;
+  }
+
+  // LCD text takes the rest of the line as is (it may contain '?', '!', ' ' or ';' itself)
+  if (isText(line, len)) {
+    cmd.kind = CMD_TEXT;
+    cmd.text = line + 1;
+    cmd.textLen = len - 1;
+    return;
+  }
+
+  // Diagnostic words: at least two capital letters followed by '?' or '!'
+  char last = line[len - 1];
+  if ((last == '?' || last == '!') && len >= 3) {
+    bool allUpper = true;
+    for (uint8_t i = 0; i < len - 1; i++) {
+      if (!isUpper(line[i])) { allUpper = false; break; }
+    }
+    if (allUpper) {
+      cmd.kind = CMD_WORD;
+      cmd.op = last;
+      cmd.textLen = len - 1;
+      return;
+    }
+  }
+
+  // Word with a number: at least two capital letters, one space, 1..6 digits
+  const char* space = (const char*)memchr(line, ' ', len);
+  if (space != nullptr && space - line >= 2 && len - (space - line) >= 2 && len - (space - line) <= 7) {
+    uint8_t wordLen = (uint8_t)(space - line);
+    bool ok = true;
+    for (uint8_t i = 0; i < wordLen && ok; i++) ok = isUpper(line[i]);
+    uint32_t value = 0;
+    for (uint8_t i = wordLen + 1; i < len && ok; i++) {
+      ok = line[i] >= '0' && line[i] <= '9';
+      value = value * 10 + (line[i] - '0');
+    }
+    if (ok) {
+      cmd.kind = CMD_WORD;
+      cmd.op = ' ';
+      cmd.hasArg = true;
+      cmd.arg = value;
+      cmd.textLen = wordLen;
+      return;
+    }
+  }
+
+  // Batch: short commands separated by ';'
+  if (memchr(line, ';', len) != nullptr) {
+    cmd.kind = CMD_BATCH;
+    cmd.textLen = len;
+    return;
+  }
+
+  if (len == 1) {
+    cmd.kind = CMD_SHORT;
+    return;
+  }
+
+  // <op>=<hex pairs>
+  if (line[1] == '=') {
+    if (len % 2 != 0) return;   // op + '=' + an even number of digits
+    for (uint8_t i = 2; i < len; i++) {
+      if (hexValue(line[i]) == 0xFF) return;
+    }
+    cmd.kind = CMD_DATA;
+    cmd.text = line + 2;
+    cmd.textLen = len - 2;
+    return;
+  }
+
+  // <op>:<number>
+  if (line[1] != ':' || len == 2 || len > 7) return;
+
+  uint32_t value = 0;
+  for (uint8_t i = 2; i < len; i++) {
+    if (line[i] < '0' || line[i] > '9') return;
+    value = value * 10 + (line[i] - '0');
+  }
+  if (value > 0xFFFF) return;
+
+  cmd.kind = CMD_SHORT;
+  cmd.hasArg = true;
+  cmd.arg = value;
+}
+
+Command parseCommand(const LineBuffer& lb) {
+  Command cmd;
+  uint8_t len = stripSeq(lb.buf, lb.len, cmd);
+  parseBody(lb.buf, len, cmd);
+  if (lb.overflow) cmd.kind = CMD_TOO_LONG;
+  return cmd;
+}
+
+Command cmdBatchNext(const Command& batch, uint8_t& pos) {
+  Command part;
+  part.hasSeq = false;
+  part.seq = 0;
+  if (pos >= batch.textLen) {
+    parseBody(batch.text + batch.textLen, 0, part);
+    // "D:1;" ends in an empty part, that's a bad batch and not the end of it (reported once)
+    if (pos == batch.textLen && batch.textLen > 0 && batch.text[pos - 1] == ';') {
+      pos++;
+      part.kind = CMD_INVALID;
+    }
+    return part;
+  }
+
+  const char* start = batch.text + pos;
+  uint8_t len = 0;
+  while (pos + len < batch.textLen && start[len] != ';') len++;
+  pos += len + 1;   // past the ';' (or the end)
+
+  parseBody(start, len, part);
+  if (part.kind == CMD_EMPTY || part.kind == CMD_BATCH) part.kind = CMD_INVALID;
+  return part;
+}
+
+bool cmdWordIs(const Command& cmd, const char* word) {
+  return cmd.kind == CMD_WORD &&
+         strlen_P(word) == cmd.textLen &&
+         memcmp_P(cmd.text, word, cmd.textLen) == 0;
+}
+
+uint8_t cmdDataByte(const Command& cmd, uint8_t i) {
+  return (uint8_t)(hexValue(cmd.text[2 * i]) << 4 | hexValue(cmd.text[2 * i + 1]));
+}
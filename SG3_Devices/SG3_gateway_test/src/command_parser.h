@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= SERIAL COMMAND PARSER =================
+// Zero-allocation replacement for the old "String serialBuf += c" + if/else chain.
+// Bytes go into a fixed line buffer; a finished line is split into an opcode and an
+// argument in place (no copies, no heap), and main.cpp dispatches with a switch on the opcode.
+// Plain C++ on purpose (no Arduino.h), so it can be compiled and benchmarked on a PC.
+//
+// Grammar (one command per line):
+//   X            short command, no argument      -> CMD_SHORT, hasArg = false
+//   D:1          short command with a number     -> CMD_SHORT, hasArg = true, arg = 1
+//   Mline1|line2 LCD text (everything after 'M') -> CMD_TEXT,  text = "line1|line2"
+//                (the '|' is what makes it text, "MEM?" without one is a word)
+//   SCHED?       diagnostic word ending in ? / ! -> CMD_WORD,  text = "SCHED" (textLen 5), op = '?' or '!'
+//   BAUD 115200  word with a number after a space -> CMD_WORD, op = ' ', hasArg = true, arg = 115200
+//   R=0A1B2C     binary data as hex pairs        -> CMD_DATA,  text = "0A1B2C", cmdDataByte() decodes
+//   D:1;N:1;X:1  batch of short commands        -> CMD_BATCH, text = the whole line, cmdBatchNext() splits it
+// Any of them except LCD text may end in #<seq> (0..65535), e.g. "D:1#17": hasSeq = true,
+// seq = 17, and the rest of the line is parsed as if the suffix wasn't there. "#17" alone is
+// an empty command (a ping). LCD text is shown as sent, "MRoom|#12" keeps its "#12".
+// A line longer than CMD_LINE_MAX is not run (CMD_TOO_LONG), but its #<seq> is still read
+// from the end, so the sender can be told.
+
+const uint8_t CMD_LINE_MAX = 80;   // same cap as the old serialBuf protection
+const uint8_t CMD_SEQ_MAX = 6;     // "#65535"
+
+struct LineBuffer {
+  char buf[CMD_LINE_MAX + 1];
+  uint8_t len;
+  bool overflow;   // line was longer than CMD_LINE_MAX; only its last CMD_SEQ_MAX bytes are kept
+  bool ready;      // buf holds a finished line (cleared by the next byte)
+};
+
+enum CmdKind { CMD_EMPTY, CMD_SHORT, CMD_TEXT, CMD_WORD, CMD_DATA, CMD_INVALID, CMD_TOO_LONG, CMD_BATCH };
+
+struct Command {
+  CmdKind kind;
+  char op;            // opcode byte (for CMD_WORD: '?' = query, '!' = action, ' ' = with a number)
+  bool hasArg;
+  uint32_t arg;       // 0..65535 for short commands, up to 999999 for words (baud rates)
+  const char* text;   // points into the LineBuffer (CMD_TEXT / CMD_WORD), NOT NUL-terminated for words
+  uint8_t textLen;
+  bool hasSeq;        // line ended in #<seq>
+  uint16_t seq;
+};
+
+void lineReset(LineBuffer& lb);
+
+// Feeds one received byte. Returns true when '\n' completed a line; the line is then
+// NUL-terminated in lb.buf and stays valid until the next lineFeed() call.
+// Also true for a line that was too long (lb.overflow), parseCommand() makes it CMD_TOO_LONG.
+bool lineFeed(LineBuffer& lb, char c);
+
+// Splits a completed line into opcode + argument (the line itself is not modified).
+Command parseCommand(const LineBuffer& lb);
+
+// Next part of a CMD_BATCH, parsed like a line of its own (no #<seq> of its own).
+// pos starts at 0 and is moved past the part; returns CMD_EMPTY once pos is at the end
+// (an empty part, like the middle of "D:1;;X" or the end of "D:1;", comes back as CMD_INVALID).
+Command cmdBatchNext(const Command& batch, uint8_t& pos);
+
+// Compares a CMD_WORD against a literal in flash, e.g. cmdWordIs(cmd, PSTR("SCHED")).
+bool cmdWordIs(const Command& cmd, const char* word);
+
+// Byte number i of a CMD_DATA payload (there are textLen / 2 of them).
+uint8_t cmdDataByte(const Command& cmd, uint8_t i);
@@ -0,0 +1,111 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= HARDWARE ABSTRACTION LAYER =================
+// The firmware logic (gas FSM, command parser, LCD, telemetry, ...) only talks to the board
+// through the hal* functions below, never through digitalWrite / Servo / LiquidCrystal_I2C /
+// Serial / millis() directly. Two backends implement them:
+//   hal_avr.cpp   the real Uno (Arduino core + Servo + LiquidCrystal_I2C), env:uno
+//   hal_host.cpp  a virtual board on a PC (virtual clock, simulated pins/ADC/LCD/UART), env:native
+// So the same logic can be built, measured and regression-tested on Linux without a board.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(ARDUINO)
+  #include <Arduino.h>   // Print, PROGMEM, HIGH/LOW, ...
+#else
+  #include "hal_host.h"  // the same basics for the host build
+#endif
+
+// ---- Time ----
+unsigned long halMillis();
+unsigned long halMicros();
+
+// ---- Digital pins ----
+void halPinMode(uint8_t pin, uint8_t mode);
+void halDigitalWrite(uint8_t pin, uint8_t level);
+int halDigitalRead(uint8_t pin);
+
+// ---- Whole ports (Uno: pins 0..7 = port D bit 0..7, pins 8..13 = port B bit 0..5) ----
+enum HalPort { HAL_PORT_B, HAL_PORT_D, HAL_PORT_COUNT };
+
+// Sets the pins in mask to the matching bits of bits and leaves the rest of the port alone,
+// in a single register write. Interrupts are locked out for the read-modify-write, because
+// the Servo and tone() interrupts drive pins on the same ports.
+void halPortWrite(uint8_t port, uint8_t mask, uint8_t bits);
+
+// Input levels of all pins of a port at once (the PIN register)
+uint8_t halPortRead(uint8_t port);
+
+// ---- Interrupts ----
+void halInterruptsOff();
+void halInterruptsOn();
+
+// Called from interrupt context with the new pin level
+typedef void (*HalPinIsr)(uint8_t level);
+
+// Calls isr on every level change of pin. Supported pins: 2 (INT0), 4 and 8 (pin change).
+// Returns false for any other pin.
+bool halAttachPinChange(uint8_t pin, HalPinIsr isr);
+
+// ---- Sleep ----
+// Called with interrupts locked out; returns true if there is still work for the next pass
+typedef bool (*HalWakeCheck)();
+
+// Idle sleep until the next interrupt: at the latest the next Timer0 tick (~1 ms, the one
+// behind halMillis()), earlier on a UART byte in or out, a pin change or the ADC.
+// Timers, UART and ADC keep running, only the CPU stops. stayAwake() is asked with interrupts
+// locked out, so something an interrupt hands over right before can't be slept through.
+// Returns false (without sleeping) if stayAwake() said so.
+bool halIdleSleep(HalWakeCheck stayAwake);
+
+// ---- Analog inputs ----
+// Called from interrupt context with one raw conversion result of channel ch (0 = A0 ...)
+typedef void (*HalAdcIsr)(uint8_t ch, uint16_t value);
+
+// Starts background sampling of A0..A(channels-1) in turn, ~1000 conversions per second in total.
+void halAdcStart(uint8_t channels, HalAdcIsr isr);
+
+// ---- Buzzer ----
+void halTone(uint8_t pin, unsigned int freq, unsigned long durationMs);
+void halNoTone(uint8_t pin);
+
+// ---- Servos (id 0 = door, 1 = window) ----
+const uint8_t HAL_SERVO_COUNT = 2;
+void halServoAttach(uint8_t id, uint8_t pin);
+void halServoWrite(uint8_t id, int angle);
+void halServoDetach(uint8_t id);
+
+// ---- 16x2 LCD on the I2C backpack ----
+void halLcdInit();   // also clears the display and turns the backlight on
+void halLcdSetCursor(uint8_t col, uint8_t row);
+void halLcdWrite(uint8_t c);
+
+// ---- Serial link to the gateway ----
+// Calling begin again changes the rate. It waits until the TX buffer is out on the old
+// rate first, so check halSerialTxEmpty() before if that must not block.
+void halSerialBegin(unsigned long baud);
+int halSerialAvailable();
+int halSerialRead();                  // -1 if nothing is there
+int halSerialAvailableForWrite();     // bytes that fit in the TX buffer without blocking
+bool halSerialTxEmpty();              // nothing left in the TX buffer (the last byte may still be shifting out)
+void halSerialWrite(const uint8_t* data, size_t len);
+
+// ---- EEPROM (1 KB on the Uno, erased = 0xFF) ----
+// Update only writes a byte that actually changes. A write runs ~3.4 ms in the background;
+// the next read or update waits for it, so check halEepromReady() first where that matters.
+// A cell survives ~100k writes, so keep writes rare.
+const uint16_t HAL_EEPROM_SIZE = 1024;
+uint8_t halEepromRead(uint16_t addr);
+void halEepromUpdate(uint16_t addr, uint8_t value);
+bool halEepromReady();
+
+// ---- Memory diagnostics (MEM?) ----
+struct HalMemInfo {
+  unsigned int freeNow;      // bytes between the heap break and the stack right now
+  unsigned int freeMin;      // smallest that gap has ever been (stack painting high-water mark)
+  unsigned int heapBreak;    // RAM address where the heap ends
+  unsigned int staticBytes;  // .data + .bss
+};
+void halMemInfo(HalMemInfo& info);
@@ -0,0 +1,182 @@
+// HAL backend for the real board (Arduino Uno). See hal.h.
+#if defined(ARDUINO)
+
+#include "hal.h"
+#include <Wire.h>
+#include <LiquidCrystal_I2C.h>
+#include <Servo.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+// Initialize LCD and Servos based on YOUR corrected pins
+static LiquidCrystal_I2C lcd(0x27, 16, 2);
+static Servo servos[HAL_SERVO_COUNT];   // door = pin 9, window = pin 10
+
+unsigned long halMillis() { return millis(); }
+unsigned long halMicros() { return micros(); }
+
+void halPinMode(uint8_t pin, uint8_t mode) { pinMode(pin, mode); }
+void halDigitalWrite(uint8_t pin, uint8_t level) { digitalWrite(pin, level); }
+int halDigitalRead(uint8_t pin) { return digitalRead(pin); }
+
+void halPortWrite(uint8_t port, uint8_t mask, uint8_t bits) {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (port == HAL_PORT_B) PORTB = (uint8_t)((PORTB & ~mask) | (bits & mask));
+  else                    PORTD = (uint8_t)((PORTD & ~mask) | (bits & mask));
+  SREG = oldSREG;
+}
+
+uint8_t halPortRead(uint8_t port) {
+  return port == HAL_PORT_B ? PINB : PIND;
+}
+
+void halInterruptsOff() { noInterrupts(); }
+void halInterruptsOn() { interrupts(); }
+
+// Only idle mode: power-save would also stop the UART, the Timer0 tick behind millis(),
+// the Servo pulses (Timer1) and tone() (Timer2)
+bool halIdleSleep(HalWakeCheck stayAwake) {
+  cli();
+  if (stayAwake()) {
+    sei();
+    return false;
+  }
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei();          // the instruction after sei() always runs first, so no interrupt gets lost
+  sleep_cpu();    // in between and the CPU can't go to sleep with a wake-up already missed
+  sleep_disable();
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Pin change interrupts: INT0 for pin 2, PCINT for pins 4 (PD4) and 8 (PB0)
+static HalPinIsr isrPin2 = nullptr;
+static HalPinIsr isrPin4 = nullptr;
+static HalPinIsr isrPin8 = nullptr;
+
+static void onInt0() {
+  isrPin2((PIND & _BV(PD2)) ? HIGH : LOW);
+}
+
+// Pin 4 = PD4 (PCINT20, port D group)
+ISR(PCINT2_vect) {
+  if (isrPin4) isrPin4((PIND & _BV(PD4)) ? HIGH : LOW);
+}
+
+// Pin 8 = PB0 (PCINT0, port B group)
+ISR(PCINT0_vect) {
+  if (isrPin8) isrPin8((PINB & _BV(PB0)) ? HIGH : LOW);
+}
+
+bool halAttachPinChange(uint8_t pin, HalPinIsr isr) {
+  if (pin == 2) {
+    isrPin2 = isr;
+    attachInterrupt(digitalPinToInterrupt(2), onInt0, CHANGE);
+  }
+  else if (pin == 4) {
+    isrPin4 = isr;
+    PCMSK2 |= _BV(PCINT20);
+    PCIFR = _BV(PCIF2);   // forget anything that happened before
+    PCICR |= _BV(PCIE2);
+  }
+  else if (pin == 8) {
+    isrPin8 = isr;
+    PCMSK0 |= _BV(PCINT0);
+    PCIFR = _BV(PCIF0);
+    PCICR |= _BV(PCIE0);
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ADC: auto-triggered by the Timer0 overflow (the same ~1 kHz tick that drives millis()),
+// the interrupt hands over the result and switches the multiplexer to the next channel
+static HalAdcIsr adcIsr = nullptr;
+static uint8_t adcChannels = 1;
+static volatile uint8_t adcChannel = 0;
+
+ISR(ADC_vect) {
+  uint16_t v = ADC;
+  adcIsr(adcChannel, v);
+
+  // The next conversion only starts at the next Timer0 overflow, long after this,
+  // so the new multiplexer setting is guaranteed to be used for it
+  adcChannel = (uint8_t)((adcChannel + 1) % adcChannels);
+  ADMUX = (1 << REFS0) | adcChannel;   // AVcc reference (same as analogRead), ADC0.. = A0..
+}
+
+void halAdcStart(uint8_t channels, HalAdcIsr isr) {
+  adcIsr = isr;
+  adcChannels = channels;
+  adcChannel = 0;
+  ADMUX = (1 << REFS0);
+  DIDR0 |= (uint8_t)((1 << channels) - 1);   // analog only: switch off their digital input buffers
+  ADCSRB = (1 << ADTS2);                      // auto-trigger source = Timer0 overflow
+  ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) |
+           (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);   // prescaler 128 -> 125 kHz ADC clock
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+void halTone(uint8_t pin, unsigned int freq, unsigned long durationMs) { tone(pin, freq, durationMs); }
+void halNoTone(uint8_t pin) { noTone(pin); }
+
+void halServoAttach(uint8_t id, uint8_t pin) { servos[id].attach(pin); }
+void halServoWrite(uint8_t id, int angle) { servos[id].write(angle); }
+void halServoDetach(uint8_t id) { servos[id].detach(); }
+
+void halLcdInit() {
+  lcd.init();
+  lcd.backlight();
+}
+void halLcdSetCursor(uint8_t col, uint8_t row) { lcd.setCursor(col, row); }
+void halLcdWrite(uint8_t c) { lcd.write(c); }
+
+void halSerialBegin(unsigned long baud) {
+  Serial.flush();   // nothing to wait for on the first call
+  Serial.begin(baud);
+}
+int halSerialAvailable() { return Serial.available(); }
+int halSerialRead() { return Serial.read(); }
+int halSerialAvailableForWrite() { return Serial.availableForWrite(); }
+bool halSerialTxEmpty() { return Serial.availableForWrite() >= SERIAL_TX_BUFFER_SIZE - 1; }
+void halSerialWrite(const uint8_t* data, size_t len) { Serial.write(data, len); }
+
+uint8_t halEepromRead(uint16_t addr) { return eeprom_read_byte((const uint8_t*)(uintptr_t)addr); }
+void halEepromUpdate(uint16_t addr, uint8_t value) { eeprom_update_byte((uint8_t*)(uintptr_t)addr, value); }
+bool halEepromReady() { return eeprom_is_ready(); }
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory: all free RAM is painted with a known byte before main() runs. The stack grows down
+// into it, so the painted bytes still left on top of the heap = how close the stack ever got.
+extern char __data_start;
+extern char __heap_start;   // end of .bss, where the heap starts
+extern char* __brkval;      // heap break, 0 while malloc() was never used
+
+static const uint8_t STACK_PAINT = 0xC5;
+
+void paintStack() __attribute__((naked, used, section(".init3")));
+void paintStack() {
+  // Runs before the constructors and main(): nothing is on the stack yet
+  uint8_t* p = (uint8_t*)&__heap_start;
+  while (p < (uint8_t*)(uintptr_t)SP) *p++ = STACK_PAINT;
+}
+
+void halMemInfo(HalMemInfo& info) {
+  uint8_t* heapEnd = (uint8_t*)(__brkval ? __brkval : &__heap_start);
+  uint8_t top;   // lives on the stack, so its address is (almost) the stack pointer
+
+  uint8_t* p = heapEnd;
+  while (p < &top && *p == STACK_PAINT) p++;
+
+  info.freeNow = (unsigned int)(&top - heapEnd);
+  info.freeMin = (unsigned int)(p - heapEnd);
+  info.heapBreak = (unsigned int)(uintptr_t)heapEnd;
+  info.staticBytes = (unsigned int)(&__heap_start - &__data_start);
+}
+
+#endif
@@ -0,0 +1,364 @@
+// HAL backend for host builds: a virtual Uno with a virtual clock. See hal.h / hal_host.h.
+// Nothing here runs on its own; the host program calls hostAdvanceUs() to let time pass.
+#if !defined(ARDUINO)
+
+#include "hal.h"
+#include <stdio.h>
+
+static const uint8_t HOST_PINS = 20;
+static const uint8_t HOST_ADC_CHANNELS = 6;
+static const unsigned long HOST_ADC_PERIOD_US = 1024;   // Timer0 overflow at 16 MHz / 64 / 256
+static const unsigned int HOST_SERIAL_BUF = 64;         // same as the Arduino core
+
+static unsigned long nowUs = 0;
+
+static uint8_t pinLevel[HOST_PINS];
+static unsigned int pinTone[HOST_PINS];
+static HalPinIsr pinIsr[HOST_PINS];
+
+static uint16_t analogLevel[HOST_ADC_CHANNELS];
+static HalAdcIsr adcIsr = nullptr;
+static uint8_t adcChannels = 1;
+static uint8_t adcChannel = 0;
+static unsigned long adcNextUs = 0;
+
+static unsigned long portWrites = 0;
+static unsigned long sleptUs = 0;
+
+static bool servoAttached[HAL_SERVO_COUNT];
+static int servoAngle[HAL_SERVO_COUNT];
+static unsigned long servoWrites[HAL_SERVO_COUNT];
+
+static char lcdGlass[2][17] = { "                ", "                " };
+static uint8_t lcdCol = 0;
+static uint8_t lcdRow = 0;
+
+// Simple byte FIFO for the serial buffers and the two directions of the wire
+struct HostFifo {
+  uint8_t data[4096];
+  unsigned int head;
+  unsigned int count;
+
+  bool push(uint8_t c) {
+    if (count >= sizeof(data)) return false;
+    data[(head + count) % sizeof(data)] = c;
+    count++;
+    return true;
+  }
+  int pop() {
+    if (count == 0) return -1;
+    uint8_t c = data[head];
+    head = (head + 1) % sizeof(data);
+    count--;
+    return c;
+  }
+};
+
+static unsigned long serialBaud = 0;     // 0 = Serial.begin() not called yet
+static unsigned long serialByteUs = 0;
+static unsigned long gatewayBaud = 9600;
+static unsigned long serialNextUs = 0;
+static HostFifo rxWire;     // gateway -> board, not yet arrived
+static HostFifo rxBuf;      // arrived, waiting for halSerialRead() (max HOST_SERIAL_BUF)
+static HostFifo txBuf;      // written by the firmware, not yet on the wire (max HOST_SERIAL_BUF - 1)
+static HostFifo txWire;     // on the wire, waiting for hostSerialReceive()
+static unsigned long rxDropped = 0;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+size_t Print::write(const uint8_t* buf, size_t len) {
+  size_t n = 0;
+  while (len--) n += write(*buf++);
+  return n;
+}
+
+size_t Print::print(long n) {
+  if (n < 0) return print('-') + print((unsigned long)(-n));
+  return print((unsigned long)n);
+}
+
+size_t Print::print(unsigned long n) {
+  char buf[12];
+  snprintf(buf, sizeof(buf), "%lu", n);
+  return write(buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long halMillis() { return nowUs / 1000; }
+unsigned long halMicros() { return nowUs; }
+
+void halPinMode(uint8_t pin, uint8_t mode) {}
+
+void halDigitalWrite(uint8_t pin, uint8_t level) {
+  if (pin < HOST_PINS) pinLevel[pin] = level ? HIGH : LOW;
+}
+
+int halDigitalRead(uint8_t pin) {
+  return pin < HOST_PINS ? pinLevel[pin] : LOW;
+}
+
+// Port bit b is pin b on port D and pin 8 + b on port B, like on the Uno
+static uint8_t portFirstPin(uint8_t port) {
+  return port == HAL_PORT_B ? 8 : 0;
+}
+
+void halPortWrite(uint8_t port, uint8_t mask, uint8_t bits) {
+  uint8_t first = portFirstPin(port);
+  for (uint8_t b = 0; b < 8; b++) {
+    if ((mask & (1 << b)) && first + b < HOST_PINS) pinLevel[first + b] = (bits & (1 << b)) ? HIGH : LOW;
+  }
+  portWrites++;
+}
+
+uint8_t halPortRead(uint8_t port) {
+  uint8_t first = portFirstPin(port);
+  uint8_t bits = 0;
+  for (uint8_t b = 0; b < 8; b++) {
+    if (first + b < HOST_PINS && pinLevel[first + b]) bits |= (uint8_t)(1 << b);
+  }
+  return bits;
+}
+
+// The next interrupt that would wake the CPU: the Timer0 tick (same grid as the ADC trigger),
+// or a UART byte slot if a byte is on its way in or still waiting to go out.
+// Trace inputs (pins, commands) are applied by the host program between two passes,
+// so for them the wake-up happens at the next tick.
+bool halIdleSleep(HalWakeCheck stayAwake) {
+  if (stayAwake()) return false;
+
+  unsigned long wake = adcIsr ? adcNextUs : nowUs + HOST_ADC_PERIOD_US - nowUs % HOST_ADC_PERIOD_US;
+  if (serialByteUs && (rxWire.count > 0 || txBuf.count > 0) && (long)(serialNextUs - wake) < 0) {
+    wake = serialNextUs;
+  }
+  sleptUs += wake - nowUs;
+  hostAdvanceUs(wake - nowUs);
+  return true;
+}
+
+// Interrupts only ever fire from hostAdvanceUs() / hostSetPin(), between two calls into
+// the firmware, so there is nothing to lock out
+void halInterruptsOff() {}
+void halInterruptsOn() {}
+
+bool halAttachPinChange(uint8_t pin, HalPinIsr isr) {
+  if (pin != 2 && pin != 4 && pin != 8) return false;
+  pinIsr[pin] = isr;
+  return true;
+}
+
+void halAdcStart(uint8_t channels, HalAdcIsr isr) {
+  adcIsr = isr;
+  adcChannels = channels < HOST_ADC_CHANNELS ? channels : HOST_ADC_CHANNELS;
+  adcChannel = 0;
+  adcNextUs = nowUs + HOST_ADC_PERIOD_US;
+}
+
+void halTone(uint8_t pin, unsigned int freq, unsigned long durationMs) {
+  // Tone durations are not modelled, the firmware always stops its tones itself
+  if (pin < HOST_PINS) pinTone[pin] = freq;
+}
+
+void halNoTone(uint8_t pin) {
+  if (pin < HOST_PINS) pinTone[pin] = 0;
+}
+
+void halServoAttach(uint8_t id, uint8_t pin) {
+  servoAttached[id] = true;
+}
+
+void halServoWrite(uint8_t id, int angle) {
+  servoAngle[id] = angle;
+  servoWrites[id]++;
+}
+
+void halServoDetach(uint8_t id) {
+  servoAttached[id] = false;
+}
+
+void halLcdInit() {
+  memset(lcdGlass[0], ' ', 16);
+  memset(lcdGlass[1], ' ', 16);
+  lcdCol = 0;
+  lcdRow = 0;
+}
+
+void halLcdSetCursor(uint8_t col, uint8_t row) {
+  lcdCol = col;
+  lcdRow = row < 2 ? row : 1;
+  hostAdvanceUs(HOST_LCD_OP_US);
+}
+
+void halLcdWrite(uint8_t c) {
+  if (lcdCol < 16) lcdGlass[lcdRow][lcdCol] = (char)c;
+  lcdCol++;
+  hostAdvanceUs(HOST_LCD_OP_US);
+}
+
+void halSerialBegin(unsigned long baud) {
+  // Like Serial.flush(): whatever is in the TX buffer goes out on the old rate first
+  while (serialByteUs && txBuf.count > 0) hostAdvanceUs(serialByteUs);
+  serialBaud = baud;
+  serialByteUs = 10000000UL / baud;   // 8N1 = 10 bits per byte
+  serialNextUs = nowUs + serialByteUs;
+}
+
+int halSerialAvailable() { return (int)rxBuf.count; }
+int halSerialRead() { return rxBuf.pop(); }
+
+int halSerialAvailableForWrite() {
+  return (int)(HOST_SERIAL_BUF - 1 - txBuf.count);
+}
+
+bool halSerialTxEmpty() {
+  return txBuf.count == 0;
+}
+
+void halSerialWrite(const uint8_t* data, size_t len) {
+  // Like the real core: blocks (here: lets virtual time pass) while the TX buffer is full
+  for (size_t i = 0; i < len; i++) {
+    while (halSerialAvailableForWrite() <= 0) hostAdvanceUs(serialByteUs ? serialByteUs : 1);
+    txBuf.push(data[i]);
+  }
+}
+
+// EEPROM: starts erased. A changed byte keeps the EEPROM busy for the time of a real write,
+// and like on the chip, touching it again while busy waits for that write to finish.
+const unsigned long HOST_EEPROM_WRITE_US = 3400;
+static uint8_t eeprom[HAL_EEPROM_SIZE];
+static bool eepromReady = false;
+static unsigned long eepromBusyUntil = 0;
+
+uint8_t* hostEeprom() {
+  if (!eepromReady) {
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    eepromReady = true;
+  }
+  return eeprom;
+}
+
+static void eepromWait() {
+  hostEeprom();
+  if (!halEepromReady()) hostAdvanceUs(eepromBusyUntil - nowUs);
+}
+
+uint8_t halEepromRead(uint16_t addr) {
+  eepromWait();
+  return eeprom[addr % HAL_EEPROM_SIZE];
+}
+
+void halEepromUpdate(uint16_t addr, uint8_t value) {
+  eepromWait();
+  uint8_t& cell = eeprom[addr % HAL_EEPROM_SIZE];
+  if (cell == value) return;
+  cell = value;
+  eepromBusyUntil = nowUs + HOST_EEPROM_WRITE_US;
+}
+
+bool halEepromReady() {
+  return (long)(nowUs - eepromBusyUntil) >= 0;
+}
+
+// No 2 KB limit on a PC, nothing meaningful to report
+void halMemInfo(HalMemInfo& info) {
+  memset(&info, 0, sizeof(info));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Virtual board hooks
+
+void hostAdvanceUs(unsigned long us) {
+  unsigned long end = nowUs + us;
+
+  for (;;) {
+    // Next thing that happens on its own: an ADC conversion or a UART byte slot
+    unsigned long next = end;
+    if (adcIsr && (long)(adcNextUs - next) < 0) next = adcNextUs;
+    if (serialByteUs && (long)(serialNextUs - next) < 0) next = serialNextUs;
+    nowUs = next;
+
+    if (adcIsr && nowUs == adcNextUs) {
+      uint8_t ch = adcChannel;
+      adcChannel = (uint8_t)((adcChannel + 1) % adcChannels);
+      adcNextUs += HOST_ADC_PERIOD_US;
+      adcIsr(ch, analogLevel[ch]);
+    }
+    if (serialByteUs && nowUs == serialNextUs) {
+      // One byte time: one byte arrives and one byte leaves (full duplex)
+      uint8_t garble = (gatewayBaud == serialBaud) ? 0 : 0x80;
+      int c = rxWire.pop();
+      if (c >= 0) {
+        if (rxBuf.count < HOST_SERIAL_BUF) rxBuf.push((uint8_t)(c | garble));
+        else                               rxDropped++;
+      }
+      c = txBuf.pop();
+      if (c >= 0) txWire.push((uint8_t)(c | garble));
+      serialNextUs += serialByteUs;
+    }
+    if (nowUs == end) return;
+  }
+}
+
+void hostSetAnalog(uint8_t ch, uint16_t value) {
+  if (ch < HOST_ADC_CHANNELS) analogLevel[ch] = value > 1023 ? 1023 : value;
+}
+
+void hostSetPin(uint8_t pin, uint8_t level) {
+  if (pin >= HOST_PINS) return;
+  level = level ? HIGH : LOW;
+  if (pinLevel[pin] == level) return;
+  pinLevel[pin] = level;
+  if (pinIsr[pin]) pinIsr[pin](level);
+}
+
+uint8_t hostPinLevel(uint8_t pin) {
+  return pin < HOST_PINS ? pinLevel[pin] : LOW;
+}
+
+unsigned int hostToneFreq(uint8_t pin) {
+  return pin < HOST_PINS ? pinTone[pin] : 0;
+}
+
+bool hostServoAttached(uint8_t id) {
+  return id < HAL_SERVO_COUNT && servoAttached[id];
+}
+
+int hostServoAngle(uint8_t id) {
+  return id < HAL_SERVO_COUNT ? servoAngle[id] : 0;
+}
+
+unsigned long hostServoWrites(uint8_t id) {
+  return id < HAL_SERVO_COUNT ? servoWrites[id] : 0;
+}
+
+unsigned long hostPortWrites() {
+  return portWrites;
+}
+
+unsigned long hostSleptUs() {
+  return sleptUs;
+}
+
+const char* hostLcdRow(uint8_t row) {
+  return lcdGlass[row < 2 ? row : 1];
+}
+
+void hostSerialSend(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) rxWire.push(data[i]);
+}
+
+int hostSerialReceive() {
+  return txWire.pop();
+}
+
+unsigned long hostSerialRxDropped() {
+  return rxDropped;
+}
+
+void hostSerialSetBaud(unsigned long baud) {
+  gatewayBaud = baud;
+}
+
+unsigned long hostSerialBaud() {
+  return serialBaud;
+}
+
+#endif
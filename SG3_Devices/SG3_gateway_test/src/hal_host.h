@@ -0,0 +1,92 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= HOST BUILD BASICS =================
+// Only used when building for a PC (env:native). Gives the firmware the few Arduino basics
+// it uses besides the hal* functions (Print, HIGH/LOW, PROGMEM, ...), plus the hooks a
+// host program uses to drive the virtual board from the outside (see hal_host.cpp).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+// No separate flash address space on a PC
+#define PROGMEM
+#define PSTR(s) (s)
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strlen_P strlen
+#define strncpy_P strncpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+// Same interface as the Arduino Print class (decimal numbers only, that is all we use)
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t len);
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+  size_t print(const char* s)   { return write(s); }
+  size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+  size_t print(char c)          { return write((uint8_t)c); }
+  size_t print(int n)           { return print((long)n); }
+  size_t print(unsigned int n)  { return print((unsigned long)n); }
+  size_t print(long n);
+  size_t print(unsigned long n);
+
+  size_t println()                { return write((const uint8_t*)"\r\n", 2); }
+  size_t println(const char* s)   { return print(s) + println(); }
+  size_t println(const __FlashStringHelper* s) { return print(s) + println(); }
+  size_t println(char c)          { return print(c) + println(); }
+  size_t println(int n)           { return print(n) + println(); }
+  size_t println(unsigned int n)  { return print(n) + println(); }
+  size_t println(long n)          { return print(n) + println(); }
+  size_t println(unsigned long n) { return print(n) + println(); }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Virtual board hooks (host only)
+
+// Virtual cost of one LCD operation (setCursor or one character over the I2C backpack)
+const unsigned long HOST_LCD_OP_US = 1000;
+
+// Moves the virtual clock forward. Everything time driven happens here: ADC conversions
+// (one per 1024 us like the Timer0 overflow trigger), UART bytes in/out at the baud rate.
+void hostAdvanceUs(unsigned long us);
+
+// Sensor side: analog level of A0..A3 and level of an input pin (fires its pin change ISR)
+void hostSetAnalog(uint8_t ch, uint16_t value);
+void hostSetPin(uint8_t pin, uint8_t level);
+
+// Actuator side: what the firmware drives right now
+uint8_t hostPinLevel(uint8_t pin);
+unsigned int hostToneFreq(uint8_t pin);   // 0 = no tone
+bool hostServoAttached(uint8_t id);
+int hostServoAngle(uint8_t id);
+unsigned long hostServoWrites(uint8_t id);
+unsigned long hostPortWrites();           // halPortWrite() calls so far
+unsigned long hostSleptUs();              // virtual time spent in halIdleSleep()
+const char* hostLcdRow(uint8_t row);      // 16 characters + NUL, what is on the glass
+
+// The EEPROM contents (HAL_EEPROM_SIZE bytes), to load an image before setup() / save it after
+uint8_t* hostEeprom();
+
+// Gateway side of the serial link. Sent bytes go over the virtual wire at the baud rate.
+// The gateway has a rate of its own (9600 until changed). While it differs from the one the
+// firmware set, every byte arrives garbled in both directions (bit 7 set, like framing junk).
+void hostSerialSend(const uint8_t* data, size_t len);
+int hostSerialReceive();                  // next byte the firmware sent, -1 if none
+unsigned long hostSerialRxDropped();      // bytes lost because the firmware RX buffer was full
+void hostSerialSetBaud(unsigned long baud);
+unsigned long hostSerialBaud();           // rate the firmware set with halSerialBegin(), 0 = none yet
@@ -0,0 +1,483 @@
+// Entry point of the host build (env:native): a simulator that runs setup()/loop() on the
+// virtual board from hal_host.cpp, driven by a scripted trace, as fast as the PC can go.
+//
+//   .pio/build/native/program [-q] [-p <us per loop pass>] [-e <eeprom file>] <trace file | ->
+//
+// It prints a timeline of everything the firmware does (actuators, buzzer, LCD, serial
+// lines) with virtual timestamps, checks the EXPECT lines of the trace and exits with 1
+// if one of them failed. -q leaves the serial lines out of the timeline.
+// -e keeps the EEPROM in a file: loaded at power on (if it exists), saved at the end, so a
+// second trace run with the same file is the board coming back after a reset.
+//
+// Trace format, one event per line (lines starting with # are comments):
+//   <time> <event>        time in ms since power on, or +ms after the previous line
+//
+//   A0 300                analog input A0..A3 jumps to 300
+//   A0 RAMP 400 500       analog input moves linearly to 400 within 500 ms
+//   D2 1                  digital input pin 2, 4 or 8 (PIR / button 1 / button 2) to 1 or 0
+//   PRESS 4 200           button on pin 4 or 8 held down for 200 ms
+//   SEND D:1              gateway sends a command line
+//   BAUD 115200           gateway switches its side of the serial link to this rate
+//                         (bytes arrive garbled while it differs from the firmware's rate)
+//   MARK gas              starts a measurement: the summary tells how long after it each
+//                         actuator first changed (e.g. "fan_ina 1 +6202 ms" = time to ventilation)
+//   EXPECT fan_ina 1      fails unless the signal has this value right now (names as in
+//                         the timeline: door window fan_ina fan_inb white orange relay buzzer lcd baud)
+//   END                   stop the simulation (otherwise it stops at the last line)
+//
+// Sample traces are in sim/.
+#if !defined(ARDUINO)
+
+#include "hal.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+void setup();
+void loop();
+
+// Virtual CPU time charged for one pass of loop() (on top of the LCD cost in the HAL).
+// Rough estimate for the Uno: ~20 digitalWrite()/millis() calls, the melody and siren
+// checks, plus a Servo::write() (~40 us, map() divides longs) now and then. Can be changed with -p <us>.
+static unsigned long simPassUs = 200;
+
+// A tone that stopped less than this long ago still counts as "tone" (beep-beep gaps, melodies)
+static const unsigned long SIM_TONE_HOLD_MS = 400;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Trace
+
+enum TraceOp { TR_ANALOG, TR_RAMP, TR_PIN, TR_SEND, TR_BAUD, TR_MARK, TR_EXPECT, TR_END };
+
+struct TraceEvent {
+  unsigned long ms;
+  TraceOp op;
+  int target;            // analog channel or pin
+  int value;
+  unsigned long durMs;   // ramp time
+  std::string text;      // SEND line, MARK label, EXPECT signal + value
+  int line;
+};
+
+static std::vector<TraceEvent> trace;
+
+static bool parseTrace(FILE* f) {
+  char buf[256];
+  int lineNo = 0;
+  unsigned long lastMs = 0;
+
+  while (fgets(buf, sizeof(buf), f)) {
+    lineNo++;
+    std::string s(buf);
+    while (!s.empty() && isspace((unsigned char)s.back())) s.pop_back();
+    size_t p = s.find_first_not_of(" \t");
+    if (p == std::string::npos || s[p] == '#') continue;
+
+    char timeTok[32], word[32];
+    int used = 0;
+    if (sscanf(s.c_str() + p, "%31s %31s %n", timeTok, word, &used) < 2) {
+      fprintf(stderr, "trace line %d: expected <time> <event>\n", lineNo);
+      return false;
+    }
+    std::string rest = s.substr(p + used);
+
+    TraceEvent e = TraceEvent();
+    e.line = lineNo;
+    e.ms = (timeTok[0] == '+') ? lastMs + strtoul(timeTok + 1, nullptr, 10) : strtoul(timeTok, nullptr, 10);
+    lastMs = e.ms;
+
+    std::string w(word);
+    bool ok = true;
+    if (w.size() == 2 && w[0] == 'A' && w[1] >= '0' && w[1] <= '3') {
+      e.target = w[1] - '0';
+      char sub[16];
+      int to; unsigned long dur;
+      if (sscanf(rest.c_str(), "%15s %d %lu", sub, &to, &dur) == 3 && std::string(sub) == "RAMP") {
+        e.op = TR_RAMP; e.value = to; e.durMs = dur;
+      } else {
+        e.op = TR_ANALOG;
+        ok = sscanf(rest.c_str(), "%d", &e.value) == 1;
+      }
+    }
+    else if (w == "D2" || w == "D4" || w == "D8") {
+      e.op = TR_PIN;
+      e.target = w[1] - '0';
+      ok = sscanf(rest.c_str(), "%d", &e.value) == 1;
+    }
+    else if (w == "PRESS") {
+      unsigned long holdMs;
+      ok = sscanf(rest.c_str(), "%d %lu", &e.target, &holdMs) == 2 && (e.target == 4 || e.target == 8);
+      e.op = TR_PIN;
+      e.value = LOW;
+      TraceEvent up = e;
+      up.ms = e.ms + holdMs;
+      up.value = HIGH;
+      if (ok) trace.push_back(up);
+    }
+    else if (w == "SEND")   { e.op = TR_SEND; e.text = rest; }
+    else if (w == "BAUD")   { e.op = TR_BAUD; ok = sscanf(rest.c_str(), "%d", &e.value) == 1 && e.value > 0; }
+    else if (w == "MARK")   { e.op = TR_MARK; e.text = rest; }
+    else if (w == "EXPECT") { e.op = TR_EXPECT; e.text = rest; ok = rest.find(' ') != std::string::npos; }
+    else if (w == "END")    { e.op = TR_END; }
+    else ok = false;
+
+    if (!ok) {
+      fprintf(stderr, "trace line %d: can't read \"%s\"\n", lineNo, s.c_str() + p);
+      return false;
+    }
+    trace.push_back(e);
+  }
+
+  // PRESS adds its release later in the list, so put everything in time order (stable: same time keeps file order)
+  std::stable_sort(trace.begin(), trace.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) { return a.ms < b.ms; });
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Timeline
+
+enum Signal { SIG_DOOR, SIG_WINDOW, SIG_FAN_INA, SIG_FAN_INB, SIG_WHITE, SIG_ORANGE, SIG_RELAY, SIG_BUZZER, SIG_BAUD, SIG_LCD, SIG_COUNT };
+static const char* signalNames[SIG_COUNT] = { "door", "window", "fan_ina", "fan_inb", "white", "orange", "relay", "buzzer", "baud", "lcd" };
+
+static std::string shown[SIG_COUNT];       // value last written to the timeline
+static std::string lcdLastPass;            // LCD is only reported once a flush has settled
+static unsigned long lastToneMs = 0;
+static bool toneSeen = false;
+
+struct Mark {
+  std::string label;
+  unsigned long ms;
+  std::string firstChange;   // first change of every actuator after the mark, for the summary
+  bool changed[SIG_COUNT];
+};
+static std::vector<Mark> marks;
+
+static unsigned expectPassed = 0;
+static unsigned expectFailed = 0;
+static bool quiet = false;
+
+static double nowMsF() {
+  return halMicros() / 1000.0;
+}
+
+static void timeline(const char* name, const std::string& value) {
+  printf("%10.1f  %-8s %s", nowMsF(), name, value.c_str());
+  if (!marks.empty()) printf("   (+%lu ms after %s)", halMillis() - marks.back().ms, marks.back().label.c_str());
+  printf("\n");
+}
+
+static std::string trimmed(const char* row) {
+  std::string s(row);
+  while (!s.empty() && s.back() == ' ') s.pop_back();
+  return s;
+}
+
+// A detached servo stays where it was (the gear holds it), "off" = never attached yet
+static bool servoSeen[2];
+
+static std::string servoValue(uint8_t id) {
+  if (hostServoAttached(id)) servoSeen[id] = true;
+  if (!servoSeen[id]) return "off";
+  int a = hostServoAngle(id);
+  if (a <= 0) return "closed";
+  if (a >= 150) return "open";
+  return "moving";
+}
+
+static std::string signalValue(int sig) {
+  switch (sig) {
+    case SIG_DOOR:    return servoValue(0);
+    case SIG_WINDOW:  return servoValue(1);
+    case SIG_FAN_INA: return std::to_string(hostPinLevel(7));
+    case SIG_FAN_INB: return std::to_string(hostPinLevel(6));
+    case SIG_WHITE:   return std::to_string(hostPinLevel(13));
+    case SIG_ORANGE:  return std::to_string(hostPinLevel(5));
+    case SIG_RELAY:   return std::to_string(hostPinLevel(12));
+    case SIG_BUZZER:
+      if (hostPinLevel(3) == HIGH) return "solid";
+      if (toneSeen && halMillis() - lastToneMs < SIM_TONE_HOLD_MS) return "tone";
+      return "off";
+    case SIG_BAUD:    return std::to_string(hostSerialBaud());
+    default:
+      return trimmed(hostLcdRow(0)) + "|" + trimmed(hostLcdRow(1));
+  }
+}
+
+// Raw output state, compared with memcmp so passes where nothing moved stay cheap
+struct RawOutputs {
+  uint8_t pins[6];
+  uint8_t buzzerTone;
+  uint8_t servoAttached[2];
+  int servoAngle[2];
+  unsigned long baud;
+  char lcd[2][17];
+};
+static RawOutputs lastRaw;
+static bool rawChanged = true;
+
+// Compares every output with what the timeline shows and reports the changes
+static void recordOutputs() {
+  if (hostToneFreq(3) > 0) {
+    toneSeen = true;
+    lastToneMs = halMillis();
+  }
+
+  RawOutputs raw;
+  memset(&raw, 0, sizeof(raw));
+  static const uint8_t pins[6] = { 3, 5, 6, 7, 12, 13 };
+  for (uint8_t i = 0; i < 6; i++) raw.pins[i] = hostPinLevel(pins[i]);
+  raw.buzzerTone = toneSeen && halMillis() - lastToneMs < SIM_TONE_HOLD_MS;
+  for (uint8_t id = 0; id < 2; id++) {
+    raw.servoAttached[id] = hostServoAttached(id);
+    raw.servoAngle[id] = hostServoAngle(id);
+  }
+  raw.baud = hostSerialBaud();
+  memcpy(raw.lcd[0], hostLcdRow(0), 17);
+  memcpy(raw.lcd[1], hostLcdRow(1), 17);
+
+  // One more full check after the last change, so a settled LCD gets reported
+  bool changed = memcmp(&raw, &lastRaw, sizeof(raw)) != 0;
+  lastRaw = raw;
+  if (!changed && !rawChanged) return;
+  rawChanged = changed;
+
+  for (int sig = 0; sig < SIG_COUNT; sig++) {
+    std::string v = signalValue(sig);
+    if (sig == SIG_LCD) {
+      bool settled = (v == lcdLastPass);
+      lcdLastPass = v;
+      if (!settled) continue;
+    }
+    if (v == shown[sig]) continue;
+    shown[sig] = v;
+    timeline(signalNames[sig], sig == SIG_LCD ? "\"" + v + "\"" : v);
+
+    if (!marks.empty()) {
+      Mark& m = marks.back();
+      long since = (long)(halMillis() - m.ms);
+      if (sig != SIG_LCD && !m.changed[sig]) {
+        m.changed[sig] = true;
+        m.firstChange += std::string("\n  ") + signalNames[sig] + " " + v + " +" + std::to_string(since) + " ms";
+      }
+    }
+  }
+}
+
+// Firmware -> gateway bytes, one timeline entry per line (or per binary frame)
+static std::string serialLine;
+
+static void recordSerial() {
+  int c;
+  while ((c = hostSerialReceive()) >= 0) {
+    if (c != '\n' && c != 0) {
+      if (c != '\r') serialLine += (char)c;
+      continue;
+    }
+    if (serialLine.empty()) continue;
+
+    bool printable = true;
+    for (char ch : serialLine) if (!isprint((unsigned char)ch)) printable = false;
+    if (!quiet) {
+      if (printable) timeline("serial", serialLine);
+      else           timeline("serial", "<" + std::to_string(serialLine.size()) + " byte frame>");
+    }
+    serialLine.clear();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Driving the inputs
+
+struct Ramp {
+  bool active;
+  unsigned long startMs;
+  unsigned long durMs;
+  int from;
+  int to;
+};
+static Ramp ramps[4];
+static int analogNow[4];
+
+static void setAnalog(int ch, int v) {
+  analogNow[ch] = v;
+  hostSetAnalog((uint8_t)ch, (uint16_t)(v < 0 ? 0 : v));
+}
+
+static void updateRamps() {
+  for (int ch = 0; ch < 4; ch++) {
+    Ramp& r = ramps[ch];
+    if (!r.active) continue;
+    unsigned long t = halMillis() - r.startMs;
+    if (t >= r.durMs) {
+      setAnalog(ch, r.to);
+      r.active = false;
+    } else {
+      setAnalog(ch, r.from + (int)((long)(r.to - r.from) * (long)t / (long)r.durMs));
+    }
+  }
+}
+
+static void checkExpect(const TraceEvent& e) {
+  size_t sp = e.text.find(' ');
+  std::string name = e.text.substr(0, sp);
+  std::string want = e.text.substr(sp + 1);
+
+  for (int sig = 0; sig < SIG_COUNT; sig++) {
+    if (name != signalNames[sig]) continue;
+    std::string got = signalValue(sig);
+    if (got == want) {
+      expectPassed++;
+    } else {
+      expectFailed++;
+      timeline("FAIL", "line " + std::to_string(e.line) + ": " + name + " is \"" + got + "\", expected \"" + want + "\"");
+    }
+    return;
+  }
+  expectFailed++;
+  timeline("FAIL", "line " + std::to_string(e.line) + ": unknown signal " + name);
+}
+
+// Applies one trace event. Returns false on END.
+static bool applyEvent(const TraceEvent& e) {
+  char buf[64];
+  switch (e.op) {
+    case TR_ANALOG:
+      ramps[e.target].active = false;
+      setAnalog(e.target, e.value);
+      snprintf(buf, sizeof(buf), "> A%d", e.target);
+      timeline(buf, std::to_string(e.value));
+      break;
+    case TR_RAMP:
+      ramps[e.target] = { true, halMillis(), e.durMs ? e.durMs : 1, analogNow[e.target], e.value };
+      snprintf(buf, sizeof(buf), "> A%d", e.target);
+      timeline(buf, "ramp to " + std::to_string(e.value) + " in " + std::to_string(e.durMs) + " ms");
+      break;
+    case TR_PIN:
+      hostSetPin((uint8_t)e.target, e.value ? HIGH : LOW);
+      snprintf(buf, sizeof(buf), "> D%d", e.target);
+      timeline(buf, std::to_string(e.value ? 1 : 0));
+      break;
+    case TR_SEND: {
+      std::string line = e.text + "\n";
+      hostSerialSend((const uint8_t*)line.data(), line.size());
+      timeline("> send", e.text);
+      break;
+    }
+    case TR_BAUD:
+      hostSerialSetBaud((unsigned long)e.value);
+      timeline("> baud", std::to_string(e.value));
+      break;
+    case TR_MARK:
+      marks.push_back(Mark());
+      marks.back().label = e.text;
+      marks.back().ms = halMillis();
+      timeline("> mark", e.text);
+      break;
+    case TR_EXPECT:
+      checkExpect(e);
+      break;
+    case TR_END:
+      return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  const char* eepromPath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0)                 quiet = true;
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) simPassUs = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) eepromPath = argv[++i];
+    else                                              path = argv[i];
+  }
+  if (path == nullptr) {
+    fprintf(stderr, "usage: %s [-q] [-p <us per loop pass>] [-e <eeprom file>] <trace file | ->\n", argv[0]);
+    return 2;
+  }
+
+  FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (f == nullptr) {
+    fprintf(stderr, "can't open %s\n", path);
+    return 2;
+  }
+  bool ok = parseTrace(f);
+  if (f != stdin) fclose(f);
+  if (!ok) return 2;
+
+  // Inputs idle: buttons released (HIGH), no motion
+  hostSetPin(4, HIGH);
+  hostSetPin(8, HIGH);
+
+  if (eepromPath != nullptr) {
+    FILE* e = fopen(eepromPath, "rb");
+    if (e != nullptr) {
+      if (fread(hostEeprom(), 1, HAL_EEPROM_SIZE, e) != HAL_EEPROM_SIZE) {
+        fprintf(stderr, "%s is not a %u byte EEPROM image\n", eepromPath, (unsigned)HAL_EEPROM_SIZE);
+        fclose(e);
+        return 2;
+      }
+      fclose(e);
+    }
+  }
+
+  auto wallStart = std::chrono::steady_clock::now();
+
+  setup();
+
+  size_t next = 0;
+  unsigned long lastRecordMs = (unsigned long)-1;
+  for (;;) {
+    bool end = false;
+    while (next < trace.size() && halMillis() >= trace[next].ms) {
+      if (!applyEvent(trace[next++])) {
+        end = true;
+        break;
+      }
+    }
+    if (end || next >= trace.size()) break;   // END, or the last line of the trace
+
+    updateRamps();
+    loop();
+    hostAdvanceUs(simPassUs ? simPassUs : 1);
+    recordSerial();
+
+    // The timeline has 1 ms resolution, no need to compare all outputs after every pass
+    if (halMillis() != lastRecordMs) {
+      lastRecordMs = halMillis();
+      recordOutputs();
+    }
+  }
+
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+
+  if (eepromPath != nullptr) {
+    FILE* e = fopen(eepromPath, "wb");
+    if (e == nullptr || fwrite(hostEeprom(), 1, HAL_EEPROM_SIZE, e) != HAL_EEPROM_SIZE) {
+      fprintf(stderr, "can't write %s\n", eepromPath);
+    }
+    if (e != nullptr) fclose(e);
+  }
+
+  printf("\n--- summary ---\n");
+  for (const Mark& m : marks) {
+    printf("mark '%s' at %lu ms:", m.label.c_str(), m.ms);
+    printf("%s\n", m.firstChange.empty() ? " no actuator changed" : m.firstChange.c_str());
+  }
+  printf("servo writes: door %lu, window %lu\n", hostServoWrites(0), hostServoWrites(1));
+  printf("port writes: %lu\n", hostPortWrites());
+  printf("cpu awake: %.1f%%\n", halMicros() ? 100.0 - 100.0 * hostSleptUs() / halMicros() : 100.0);
+  printf("expectations: %u passed, %u failed\n", expectPassed, expectFailed);
+  printf("simulated %lu ms in %.1f ms wall (%.0fx real time)\n",
+         halMillis(), wallMs, wallMs > 0 ? halMillis() / wallMs : 0.0);
+
+  return expectFailed > 0 ? 1 : 0;
+}
+
+#endif
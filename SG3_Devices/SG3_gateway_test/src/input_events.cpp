@@ -0,0 +1,134 @@
+#include "input_events.h"
+#include "pins.h"
+
+// 5 bytes per edge (input and level share one byte)
+struct InputEdge {
+  uint8_t input : 7;
+  uint8_t level : 1;
+  unsigned long us;
+};
+
+// Single-producer (ISR) / single-consumer (loop) ring. Only the ISR writes edgeHead and only
+// the loop writes edgeTail; both are single bytes, so reading them is atomic on the AVR.
+static InputEdge edgeQueue[INPUT_QUEUE_SIZE];
+static volatile uint8_t edgeHead = 0;
+static volatile uint8_t edgeTail = 0;
+static volatile uint8_t edgeDropped = 0;
+
+static const PinDef inputPins[INPUT_COUNT] = { PIN_PIR, PIN_BTN1, PIN_BTN2 };
+
+// Main loop side state
+struct InputState {
+  uint8_t stable;            // debounced level
+  uint8_t raw;               // level of the last edge
+  unsigned long rawSinceUs;  // when raw last changed
+  unsigned long pressedMs;   // halMillis() when the debounced press happened
+  bool longSent;
+};
+static InputState inputState[INPUT_COUNT];
+
+static inline void pushEdge(uint8_t input, uint8_t level) {
+  uint8_t head = edgeHead;
+  uint8_t next = (uint8_t)((head + 1) & (INPUT_QUEUE_SIZE - 1));
+  if (next == edgeTail) {
+    if (edgeDropped < 255) edgeDropped++;
+    return;
+  }
+  edgeQueue[head].input = input;
+  edgeQueue[head].level = level;
+  edgeQueue[head].us = halMicros();
+  edgeHead = next;   // publish only after the entry is complete
+}
+
+static bool popEdge(InputEdge& e) {
+  uint8_t tail = edgeTail;
+  if (tail == edgeHead) return false;
+  e = edgeQueue[tail];
+  edgeTail = (uint8_t)((tail + 1) & (INPUT_QUEUE_SIZE - 1));
+  return true;
+}
+
+// Called by the HAL from interrupt context with the new pin level
+static void isrPir(uint8_t level)  { pushEdge(INPUT_PIR, level); }
+static void isrBtn1(uint8_t level) { pushEdge(INPUT_BTN1, level); }
+static void isrBtn2(uint8_t level) { pushEdge(INPUT_BTN2, level); }
+
+bool inputsPending() {
+  return edgeHead != edgeTail;
+}
+
+void inputsBegin() {
+  for (uint8_t i = 0; i < INPUT_COUNT; i++) {
+    uint8_t level = pinRead(inputPins[i]);
+    inputState[i].stable = level;
+    inputState[i].raw = level;
+    inputState[i].rawSinceUs = halMicros();
+    inputState[i].pressedMs = 0;
+    inputState[i].longSent = false;
+  }
+
+  halAttachPinChange(PIN_PIR.pin, isrPir);
+  halAttachPinChange(PIN_BTN1.pin, isrBtn1);
+  halAttachPinChange(PIN_BTN2.pin, isrBtn2);
+}
+
+// Commits the raw level of a button once it has been stable for the debounce time
+static void settleButton(InputId id, unsigned long nowUs, InputHandler handler) {
+  InputState& s = inputState[id];
+  if (s.raw == s.stable) return;
+  if (nowUs - s.rawSinceUs < INPUT_DEBOUNCE_US) return;
+
+  s.stable = s.raw;
+  if (s.stable == LOW) {
+    s.pressedMs = halMillis();
+    s.longSent = false;
+    handler(id, INPUT_PRESS, s.rawSinceUs);
+  } else if (!s.longSent) {
+    handler(id, INPUT_RELEASE, s.rawSinceUs);
+  }
+}
+
+void inputsPoll(InputHandler handler) {
+  InputEdge e;
+  while (popEdge(e)) {
+    if (e.input == INPUT_PIR) {
+      // The PIR output is clean, no debounce needed
+      InputState& s = inputState[INPUT_PIR];
+      if (e.level == s.stable) continue;
+      s.stable = s.raw = e.level;
+      handler(INPUT_PIR, e.level == HIGH ? INPUT_RISE : INPUT_FALL, e.us);
+      continue;
+    }
+
+    // Before taking the new edge, check whether the previous level had already
+    // settled by the time this edge happened (a full press can sit in the queue)
+    InputId id = (InputId)e.input;
+    settleButton(id, e.us, handler);
+
+    InputState& s = inputState[id];
+    if (e.level != s.raw) {
+      s.raw = e.level;
+      s.rawSinceUs = e.us;
+    }
+  }
+
+  unsigned long nowUs = halMicros();
+  for (uint8_t i = INPUT_BTN1; i < INPUT_COUNT; i++) {
+    InputId id = (InputId)i;
+    settleButton(id, nowUs, handler);
+
+    InputState& s = inputState[id];
+    if (s.stable == LOW && !s.longSent && halMillis() - s.pressedMs >= INPUT_LONG_PRESS_MS) {
+      s.longSent = true;
+      handler(id, INPUT_LONG, nowUs);
+    }
+  }
+}
+
+int inputLevel(InputId input) {
+  return inputState[input].stable;
+}
+
+uint8_t inputsDropped() {
+  return edgeDropped;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= INTERRUPT-DRIVEN INPUTS =================
+// The PIR (pin 2) and the two buttons (pins 4 and 8) are no longer polled with digitalRead().
+// Every level change raises an interrupt (INT0 for pin 2, pin-change interrupts for 4 and 8,
+// both set up by the HAL, see halAttachPinChange() in hal.h)
+// which pushes a timestamped edge into a small lock-free queue (ISR = only producer,
+// main loop = only consumer). inputsPoll() drains the queue in the main loop and does
+// debouncing and long-press detection there, using the edge timestamps, so even a press
+// shorter than one pass of loop() is seen, and reported with the time it really happened.
+
+enum InputId { INPUT_PIR, INPUT_BTN1, INPUT_BTN2, INPUT_COUNT };
+
+enum InputEvent {
+  INPUT_PRESS,      // button went down (LOW), after debounce
+  INPUT_RELEASE,    // button went up again; held < long press time
+  INPUT_LONG,       // button held for INPUT_LONG_PRESS_MS (sent once, no RELEASE follows)
+  INPUT_RISE,       // PIR output went HIGH (motion)
+  INPUT_FALL,       // PIR output went LOW
+};
+
+const unsigned long INPUT_DEBOUNCE_US = 30000UL;
+const unsigned long INPUT_LONG_PRESS_MS = 1000UL;
+const uint8_t INPUT_QUEUE_SIZE = 16;   // power of two
+
+// timeUs = micros() of the edge that caused the event
+typedef void (*InputHandler)(InputId input, InputEvent ev, unsigned long timeUs);
+
+// Configures the pins and enables the interrupts
+void inputsBegin();
+
+// Handles all queued edges and due debounce / long-press timeouts
+void inputsPoll(InputHandler handler);
+
+// True if edges are queued that inputsPoll() has not handled yet
+bool inputsPending();
+
+// Debounced level (HIGH/LOW) as the main loop currently sees it
+int inputLevel(InputId input);
+
+// Edges lost because the queue was full (INPUT? in main.cpp reports it)
+uint8_t inputsDropped();
@@ -0,0 +1,99 @@
+#include "journal.h"
+#include "telemetry_frame.h"   // crc8Update
+
+static uint8_t newestSlot = JOURNAL_SLOTS - 1;   // so the first record goes to slot 0
+static uint16_t newestSeq = 0;
+static uint8_t newestBits = 0;
+static bool haveRecord = false;
+
+// Record being written
+static uint8_t rec[JOURNAL_RECORD];
+static uint8_t recSlot = 0;
+static uint8_t recPos = JOURNAL_RECORD;   // = nothing being written
+
+static unsigned long recordsWritten = 0;
+static unsigned long restoreUs = 0;
+
+// The record crc starts from a non-zero seed: with the plain crc8 (init 0) a zeroed
+// slot (0 0 0 0) would pass as a valid record. Erased cells (0xFF) fail either way.
+static const uint8_t JOURNAL_CRC_SEED = 0x5A;
+
+static uint8_t recordCrc(const uint8_t* r) {
+  uint8_t crc = JOURNAL_CRC_SEED;
+  for (uint8_t i = 0; i < JOURNAL_RECORD - 1; i++) crc = crc8Update(crc, r[i]);
+  return crc;
+}
+
+static uint16_t slotAddr(uint8_t slot) {
+  return JOURNAL_EEPROM_ADDR + (uint16_t)slot * JOURNAL_RECORD;
+}
+
+bool journalBegin(uint8_t& bits) {
+  unsigned long start = halMicros();
+  haveRecord = false;
+
+  for (uint8_t slot = 0; slot < JOURNAL_SLOTS; slot++) {
+    uint8_t r[JOURNAL_RECORD];
+    for (uint8_t i = 0; i < JOURNAL_RECORD; i++) r[i] = halEepromRead(slotAddr(slot) + i);
+    if (recordCrc(r) != r[JOURNAL_RECORD - 1]) continue;
+
+    // All records are within JOURNAL_SLOTS of each other, so this also works across a seq wrap
+    uint16_t seq = (uint16_t)(r[0] | r[1] << 8);
+    if (haveRecord && (int16_t)(seq - newestSeq) <= 0) continue;
+
+    haveRecord = true;
+    newestSlot = slot;
+    newestSeq = seq;
+    newestBits = r[2];
+  }
+
+  restoreUs = halMicros() - start;
+  bits = haveRecord ? newestBits : 0;
+  return haveRecord;
+}
+
+void journalPoll(uint8_t bits) {
+  if (recPos == JOURNAL_RECORD) {
+    if (haveRecord && bits == newestBits) return;
+
+    // Start the next record
+    uint16_t seq = (uint16_t)(newestSeq + 1);
+    rec[0] = (uint8_t)seq;
+    rec[1] = (uint8_t)(seq >> 8);
+    rec[2] = bits;
+    rec[3] = recordCrc(rec);
+    recSlot = (uint8_t)((newestSlot + 1) % JOURNAL_SLOTS);
+    recPos = 0;
+  }
+
+  if (!halEepromReady()) return;
+
+  halEepromUpdate(slotAddr(recSlot) + recPos, rec[recPos]);
+  recPos++;
+
+  if (recPos == JOURNAL_RECORD) {
+    haveRecord = true;
+    newestSlot = recSlot;
+    newestSeq = (uint16_t)(rec[0] | rec[1] << 8);
+    newestBits = rec[2];
+    recordsWritten++;
+  }
+}
+
+bool journalReportLine(Print& out, uint8_t index) {
+  if (index > 0) return false;
+
+  out.print(F("JNL slot="));
+  out.print(newestSlot);
+  out.print(F(" seq="));
+  out.print(newestSeq);
+  out.print(F(" bits="));
+  out.print(newestBits);
+  out.print(F(" writes="));
+  out.print(recordsWritten);
+  out.print(F(" restore_us="));
+  out.print(restoreUs);
+  if (recPos != JOURNAL_RECORD) out.print(F(" busy"));
+  out.println();
+  return true;
+}
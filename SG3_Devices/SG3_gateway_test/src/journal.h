@@ -0,0 +1,35 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= STATE JOURNAL =================
+// Remembers the actuators across a reboot, so the house comes back the way it was instead of
+// everything off until the gateway has pushed the state from Firestore again.
+//
+// Every change of the actuator bits (STATE_BIT_* in telemetry_frame.h) is appended to a ring of
+// 4-byte records in EEPROM: [seq lo] [seq hi] [bits] [crc8 of the first 3 bytes, seeded 0x5A].
+// Appending (instead of rewriting one place) spreads the wear over all 224 slots: ~22 million
+// changes before a cell wears out. The newest record is the valid one with the highest seq.
+// The crc is written last, so a record cut off by a reset is simply ignored.
+//
+// Writing never blocks: journalPoll() writes one byte whenever the EEPROM is ready
+// (~3.4 ms per byte), a change that comes in meanwhile is written right after.
+//
+// Bit 7 (motion in the STATE frame) is not journaled; here it holds the restore flag (J:1 / J:0):
+//   set     restore everything on boot
+//   clear   restore only the lights; door, window, fans and buzzer start closed / off (default)
+
+const uint16_t JOURNAL_EEPROM_ADDR = 128;   // after the rules (rules.h)
+const uint8_t JOURNAL_RECORD = 4;
+const uint8_t JOURNAL_SLOTS = 224;          // up to the end of the 1 KB EEPROM
+const uint8_t JOURNAL_RESTORE_ALL = 0x80;
+
+// Finds the newest record. Returns false (bits = 0) if the journal is empty or unreadable.
+bool journalBegin(uint8_t& bits);
+
+// Appends bits if they differ from the newest record. Call often, it never waits.
+void journalPoll(uint8_t bits);
+
+// JNL? report (one line)
+bool journalReportLine(Print& out, uint8_t index);
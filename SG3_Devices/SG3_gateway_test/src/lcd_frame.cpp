@@ -0,0 +1,63 @@
+#include "lcd_frame.h"
+
+LcdFrame lcdFrame;
+
+// Marks a glass cell as unknown (no printable character uses this value)
+static const char GLASS_UNKNOWN = (char)0xFF;
+
+void LcdFrame::begin() {
+  clear();
+  memset(glass, ' ', sizeof(glass));
+}
+
+void LcdFrame::clear() {
+  memset(shadow, ' ', sizeof(shadow));
+  col = 0;
+  row = 0;
+}
+
+void LcdFrame::setCursor(uint8_t c, uint8_t r) {
+  col = c;
+  row = r < LCD_ROWS ? r : LCD_ROWS - 1;
+}
+
+size_t LcdFrame::write(uint8_t c) {
+  if (col < LCD_COLS) shadow[row][col] = (char)c;
+  if (col < 255) col++;
+  return 1;
+}
+
+bool LcdFrame::dirty() const {
+  return memcmp(shadow, glass, sizeof(shadow)) != 0;
+}
+
+void LcdFrame::invalidate() {
+  memset(glass, GLASS_UNKNOWN, sizeof(glass));
+}
+
+bool LcdFrame::flushChanges(unsigned long budgetUs) {
+  unsigned long start = halMicros();
+
+  for (uint8_t r = 0; r < LCD_ROWS; r++) {
+    uint8_t c = 0;
+    while (c < LCD_COLS) {
+      if (shadow[r][c] == glass[r][c]) {
+        c++;
+        continue;
+      }
+
+      // Start of a changed run: one setCursor, then write while cells keep differing
+      halLcdSetCursor(c, r);
+      while (c < LCD_COLS && shadow[r][c] != glass[r][c]) {
+        halLcdWrite((uint8_t)shadow[r][c]);
+        glass[r][c] = shadow[r][c];
+        c++;
+
+        if (halMicros() - start >= budgetUs) {
+          return !dirty();
+        }
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= LCD SHADOW FRAMEBUFFER =================
+// The rest of the code never talks to the LCD directly any more. It draws into a 2x16
+// shadow buffer (lcdFrame.setCursor / print, just like the real lcd), and flushChanges()
+// compares the shadow with what is already on the glass and only sends the cells that differ.
+// Redrawing the same screen costs nothing on the I2C bus, and a big change is spread over
+// several calls because flushChanges() stops once its time budget is used up.
+
+const uint8_t LCD_COLS = 16;
+const uint8_t LCD_ROWS = 2;
+
+class LcdFrame : public Print {
+public:
+  // halLcdInit() must already have been called (it clears the display, so the glass starts blank)
+  void begin();
+
+  // Blanks the shadow buffer (the glass is untouched until the next flush)
+  void clear();
+  void setCursor(uint8_t col, uint8_t row);
+
+  // Characters past column 16 are dropped, like on the real display
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  // Sends changed runs of cells to the LCD until everything matches or budgetUs is used up
+  // (always at least one cell, so it keeps making progress). Returns true when the glass is up to date.
+  bool flushChanges(unsigned long budgetUs);
+
+  bool dirty() const;
+
+  // Forget what is on the glass, the next flushes redraw every cell (after halLcdInit() again)
+  void invalidate();
+
+private:
+  char shadow[LCD_ROWS][LCD_COLS];
+  char glass[LCD_ROWS][LCD_COLS];
+  uint8_t col;
+  uint8_t row;
+};
+
+extern LcdFrame lcdFrame;
@@ -1,16 +1,40 @@
-#include <Arduino.h>
-#include <Wire.h> 
-#include <LiquidCrystal_I2C.h>
-#include <Servo.h>
+#include "hal.h"
+#include "scheduler.h"
+#include "melody.h"
+#include "command_parser.h"
+#include "telemetry_frame.h"
+#include "serial_out.h"
+#include "lcd_frame.h"
+#include "adc_sampler.h"
+#include "input_events.h"
+#include "profiler.h"
+#include "state_machine.h"
+#include "rules.h"
+#include "journal.h"
+#include "servo_motion.h"
+#include "pins.h"
 
 //GLOBALS
 
-// Initialize LCD and Servos based on YOUR corrected pins
-LiquidCrystal_I2C lcd(0x27, 16, 2);
-Servo doorServo;   // Pin 9
-Servo windowServo; // Pin 10
-
-String serialBuf = "";
+// Servos (the LCD and the servo objects themselves live in the HAL, see hal.h)
+const uint8_t DOOR_SERVO = 0;     // PIN_DOOR_SERVO
+const uint8_t WINDOW_SERVO = 1;   // PIN_WINDOW_SERVO
+const int servoOpenAngle = 150;
+const int servoClosedAngle = 0;
+
+// How the servos move (see servo_motion.h): 150 degrees take ~0.7 s,
+// the window starts 250 ms after the door
+const ServoProfile servoProfile = {
+  300,    // speedDegS
+  1500,   // accelDegS2
+  400,    // settleMs
+  250     // startOffsetMs
+};
+ServoAxis doorServo;
+ServoAxis windowServo;
+
+LineBuffer serialLine;   // fixed-size line buffer for gateway commands (see command_parser.h)
+const unsigned long LINK_BOOT_BAUD = 9600;   // rate after power on (see SERIAL LINK SPEED)
 
 // Defined later in the file; needed for telemetry helper.
 extern bool manualBuzzerOn;
@@ -21,121 +45,324 @@ const int gasThreshold = 100;
 //toggle function for the window/door
 bool doorOpen = false;     // remembers door state
 bool windowOpen = false;   // remembers window state
-int lastBtn2State = HIGH;  // for edge detection
 
 //toggle function for lights
 bool whiteLightOn = false; // pin 13
 bool orangeLightOn = false; // pin 5
 
-//SONG SETUP
-//when the touch/water sensor detects something, a song will play
-bool songPlayed = false;
-
 //toggle function for the ventilator
 bool fan_ina_on = false;   // pin 7 state
 bool fan_inb_on = false;   // pin 6 state
-int lastBtn1State = HIGH;  // for edge detection
 
 // ================= LCD CONTROL SYSTEM =================
 
 // Controls how long temporary messages stay on screen (3 seconds)
 unsigned long messageUntil = 0;
 
-// Stores temporary message lines
-String tempLine1 = "";
-String tempLine2 = "";
+// Message priorities: a message can only replace one that is equally or less important.
+// MSG_INFO   = toggles, buttons, LCD text from the app
+// MSG_ALERT  = rain alert / closing house
+// MSG_SAFETY = gas alarm and its safety actions (never covered by a toggle message)
+enum MsgPriority { MSG_INFO, MSG_ALERT, MSG_SAFETY };
 
-// Prevents writing to LCD multiple times per loop
-bool lcdNeedsUpdate = true;
+// Stores temporary message lines (the one on screen, or the one about to be)
+char tempLine1[LCD_COLS + 1] = "";
+char tempLine2[LCD_COLS + 1] = "";
+MsgPriority tempPriority = MSG_INFO;
+
+// A new message is written straight into tempLine1/2 and waits for the next LCD task run,
+// which starts its display time. A burst of commands in one pass only keeps the last
+// (or most important) one, so the LCD is drawn once per burst.
+bool pendingMsg = false;
+unsigned long pendingDuration = 0;
 
 // Limits how often the normal sensor screen is refreshed (reduces flicker)
-unsigned long lastSensorLcdUpdate = 0;
-const unsigned long sensorLcdInterval = 500; // 2 updates per second
+const uint16_t sensorLcdInterval = 500; // 2 updates per second
+
+// Max time one pass of loop() may spend sending changed LCD cells over I2C
+// (about 1 ms per character on the I2C backpack, so a full redraw takes several passes)
+const unsigned long lcdFlushBudgetUs = 2000;
 
 // Push physical state to gateway for Firebase sync (bidirectional pipeline)
+// State is pushed as soon as something changes instead of blindly every second:
+// - any actuator / motion change goes out in the same pass of loop()
+// - gas and steam only count as changed when they moved more than their deadband
+//   since the last push (filters ADC noise), and at most every stateSensorMinInterval
+// - if nothing changed at all, a full keyframe still goes out every stateKeyframeInterval
+//   so the gateway can resync after it missed something
+const int gasDeadband = 5;                          // ADC counts
+const int steamDeadband = 5;                        // ADC counts
+const unsigned long stateSensorMinInterval = 250;   // limits pushes while a sensor keeps moving
+const unsigned long stateKeyframeInterval = 5000;
+
+// What the last push contained (for change detection)
+uint8_t sentStateBits = 0;
+int sentGas = 0;
+int sentSteam = 0;
+bool stateEverSent = false;
 unsigned long lastStatePush = 0;
-const unsigned long statePushInterval = 1000;
 
-const char* openCloseStr(bool v) {
-  return v ? "open" : "close";
+// Telemetry format: false = ASCII STATE line (default after every reset), true = binary frame.
+// The gateway switches with T:1 / T:0 (see telemetry_frame.h).
+bool binaryTelemetry = false;
+uint8_t stateFrameSeq = 0;
+
+// Actuator state from the EEPROM journal (see journal.h), applied by setup().
+// restoreAll = J:1 -> door, window, fans and buzzer come back too, J:0 -> they start safe.
+uint8_t bootStateBits = 0;
+bool restoreAll = false;
+
+// Latest sensor samples (written by the sensor task, read by everyone else)
+// The analog ones are already filtered (see adc_sampler.h)
+int gasValue = 0;
+int lightValue = 0;
+int soilValue = 0;
+int steamValue = 0;
+int motionValue = LOW;
+
+// ================= TASK TABLE =================
+// Order = priority inside one pass of loop(). Serial comes first so a command
+// from the gateway is applied by the outputs task in the same pass.
+// The functions themselves are defined further down, next to the logic they run.
+void taskSerialIngest();
+void taskBoot();
+void taskInputs();
+void taskSensors();
+void taskGasFsm();
+void taskRules();
+void taskOutputs();
+void taskLcd();
+void taskLcdFlush();
+void updateLcdFrame();
+void taskStatePush();
+void taskJournal();
+void taskSerialOut();
+void taskLink();
+
+enum TaskId { TASK_SERIAL, TASK_BOOT, TASK_INPUTS, TASK_SENSORS, TASK_GAS, TASK_RULES, TASK_OUTPUTS, TASK_LCD, TASK_LCD_FLUSH, TASK_STATE, TASK_JOURNAL, TASK_SERIAL_OUT, TASK_LINK, TASK_COUNT };
+
+// Task names live in flash (see scheduler.h)
+const char nameSerial[] PROGMEM = "serial";
+const char nameBoot[] PROGMEM = "boot";
+const char nameInputs[] PROGMEM = "inputs";
+const char nameSensors[] PROGMEM = "sensors";
+const char nameGas[] PROGMEM = "gas";
+const char nameRules[] PROGMEM = "rules";
+const char nameOutputs[] PROGMEM = "outputs";
+const char nameLcd[] PROGMEM = "lcd";
+const char nameLcdFlush[] PROGMEM = "lcdflush";
+const char nameState[] PROGMEM = "state";
+const char nameJournal[] PROGMEM = "journal";
+const char nameTxq[] PROGMEM = "txq";
+const char nameLink[] PROGMEM = "link";
+
+const Task tasks[TASK_COUNT] PROGMEM = {
+  //         name          function          period              deadline
+  SCHED_TASK(nameSerial,   taskSerialIngest, 0,                  10),
+  SCHED_TASK(nameBoot,     taskBoot,         10,                 10),
+  SCHED_TASK(nameInputs,   taskInputs,       0,                  10),
+  SCHED_TASK(nameSensors,  taskSensors,      20,                 20),
+  SCHED_TASK(nameGas,      taskGasFsm,       10,                 10),
+  SCHED_TASK(nameRules,    taskRules,        20,                 20),
+  SCHED_TASK(nameOutputs,  taskOutputs,      0,                  10),
+  SCHED_TASK(nameLcd,      taskLcd,          sensorLcdInterval,  100),
+  SCHED_TASK(nameLcdFlush, taskLcdFlush,     0,                  10),
+  SCHED_TASK(nameState,    taskStatePush,    0,                  100),
+  SCHED_TASK(nameJournal,  taskJournal,      0,                  20),
+  SCHED_TASK(nameTxq,      taskSerialOut,    0,                  10),
+  SCHED_TASK(nameLink,     taskLink,         0,                  10),
+};
+TaskState taskState[TASK_COUNT];
+
+// All fixed texts are kept in flash with F() (the Uno only has 2 KB of RAM)
+const __FlashStringHelper* openCloseStr(bool v) {
+  return v ? F("open") : F("close");
+}
+
+const __FlashStringHelper* onOffStr(bool v) {
+  return v ? F("on") : F("off");
+}
+
+// Same for the LCD messages
+const __FlashStringHelper* onOffText(bool v) {
+  return v ? F("ON") : F("OFF");
 }
 
-const char* onOffStr(bool v) {
-  return v ? "on" : "off";
+const __FlashStringHelper* openCloseText(bool v) {
+  return v ? F("OPEN") : F("CLOSE");
 }
 
-void sendStateLine(int gas, int steam, int motion) {
-  if (millis() - lastStatePush < statePushInterval) {
+// All on/off parts of the state in one byte (also used for change detection)
+uint8_t currentStateBits(int motion) {
+  uint8_t bits = 0;
+  if (doorOpen)       bits |= STATE_BIT_DOOR;
+  if (windowOpen)     bits |= STATE_BIT_WINDOW;
+  if (manualBuzzerOn) bits |= STATE_BIT_BUZZER;
+  if (fan_ina_on)     bits |= STATE_BIT_FAN_INA;
+  if (fan_inb_on)     bits |= STATE_BIT_FAN_INB;
+  if (whiteLightOn)   bits |= STATE_BIT_WHITE_LIGHT;
+  if (orangeLightOn)  bits |= STATE_BIT_ORANGE_LIGHT;
+  if (motion == HIGH) bits |= STATE_BIT_MOTION;
+  return bits;
+}
+
+// Same state as sendStateLine(), packed into a ~10 byte binary frame
+void sendStateFrame(Print& out, int gas, int steam, int motion) {
+  StateSnapshot snap;
+  snap.bits = currentStateBits(motion);
+  snap.gas = gas;
+  snap.steam = steam;
+
+  uint8_t frame[STATE_FRAME_MAX];
+  uint8_t len = buildStateFrame(snap, stateFrameSeq++, frame);
+  out.write(frame, len);
+}
+
+// Writes the STATE line (or frame) into out. Called by the outbound queue when the UART
+// is ready for it, so it always reports the newest state (see serial_out.h).
+void sendStateLine(Print& out, int gas, int steam, int motion) {
+  if (binaryTelemetry) {
+    sendStateFrame(out, gas, steam, motion);
     return;
   }
-  lastStatePush = millis();
-
-  Serial.print("STATE door=");
-  Serial.print(openCloseStr(doorOpen));
-  Serial.print(" window=");
-  Serial.print(openCloseStr(windowOpen));
-  Serial.print(" buzzer=");
-  Serial.print(onOffStr(manualBuzzerOn));
-  Serial.print(" fan_ina=");
-  Serial.print(onOffStr(fan_ina_on));
-  Serial.print(" fan_inb=");
-  Serial.print(onOffStr(fan_inb_on));
-  Serial.print(" white_light=");
-  Serial.print(onOffStr(whiteLightOn));
-  Serial.print(" orange_light=");
-  Serial.print(onOffStr(orangeLightOn));
-  Serial.print(" gas=");
-  Serial.print(gas);
-  Serial.print(" steam=");
-  Serial.print(steam);
-  Serial.print(" motion=");
-  Serial.println(motion);
+
+  out.print(F("STATE door="));
+  out.print(openCloseStr(doorOpen));
+  out.print(F(" window="));
+  out.print(openCloseStr(windowOpen));
+  out.print(F(" buzzer="));
+  out.print(onOffStr(manualBuzzerOn));
+  out.print(F(" fan_ina="));
+  out.print(onOffStr(fan_ina_on));
+  out.print(F(" fan_inb="));
+  out.print(onOffStr(fan_inb_on));
+  out.print(F(" white_light="));
+  out.print(onOffStr(whiteLightOn));
+  out.print(F(" orange_light="));
+  out.print(onOffStr(orangeLightOn));
+  out.print(F(" gas="));
+  out.print(gas);
+  out.print(F(" steam="));
+  out.print(steam);
+  out.print(F(" motion="));
+  out.println(motion);
+}
+
+// Render callback for the outbound queue: always the newest values
+void renderState(Print& out) {
+  PERF_SCOPE(PERF_STATE_LINE);
+  sendStateLine(out, gasValue, steamValue, motionValue);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 //HELPERS
+// Ask the LCD task to redraw on its next turn instead of waiting for the 500 ms refresh.
+void requestLcdRedraw() {
+  schedulerKick(TASK_LCD);
+}
+
 // =====================================================
-// Displays a temporary message for 3 seconds.
-// After 3 seconds, LCD returns to normal sensor display.
+// Displays a temporary message for 3 seconds (or durationMs).
+// After that, LCD returns to normal sensor display.
+// The message is queued and drawn by the LCD task later in the same pass of loop().
 // =====================================================
-void showTempMessage(String line1, String line2) {
-  tempLine1 = line1;
-  tempLine2 = line2;
-  messageUntil = millis() + 3000;   // Message visible for 3 seconds
-  lcdNeedsUpdate = true;            // Force LCD refresh
+// Copies at most one LCD line (16 chars), always NUL-terminated
+void copyLcdLine(char* dst, const char* src) {
+  strncpy(dst, src, LCD_COLS);
+  dst[LCD_COLS] = '\0';
+}
+
+void copyLcdLine(char* dst, const __FlashStringHelper* src) {
+  strncpy_P(dst, (const char*)src, LCD_COLS);
+  dst[LCD_COLS] = '\0';
+}
+
+// Takes the message lines for a new message; false if something more important
+// is still on screen or already waiting for this pass
+bool claimPendingMessage(MsgPriority prio, unsigned long durationMs) {
+  bool busy = pendingMsg || halMillis() < messageUntil;
+  if (busy && prio < tempPriority) return false;
+
+  pendingMsg = true;
+  tempPriority = prio;
+  pendingDuration = durationMs;
+  requestLcdRedraw();               // Force LCD refresh
+  return true;
+}
+
+// Fixed texts: showTempMessage(F("Door"), F("OPEN"))
+void showTempMessage(const __FlashStringHelper* line1, const __FlashStringHelper* line2, MsgPriority prio = MSG_INFO, unsigned long durationMs = 3000) {
+  if (!claimPendingMessage(prio, durationMs)) return;
+  copyLcdLine(tempLine1, line1);
+  copyLcdLine(tempLine2, line2);
 }
 
-// Immediately draw the temporary message to the LCD.
-// Useful before long delays (like playing a melody), so the message appears instantly.
-void forceShowTempMessageNow() {
-  lcd.setCursor(0, 0);
-  lcd.print("                ");
-  lcd.setCursor(0, 0);
-  lcd.print(tempLine1);
+// Texts built at run time (LCD text from the app)
+void showTempMessage(const char* line1, const char* line2, MsgPriority prio = MSG_INFO, unsigned long durationMs = 3000) {
+  if (!claimPendingMessage(prio, durationMs)) return;
+  copyLcdLine(tempLine1, line1);
+  copyLcdLine(tempLine2, line2);
+}
+
+// Starts the display time of the waiting message
+void commitPendingMessage() {
+  if (!pendingMsg) return;
+  pendingMsg = false;
+  messageUntil = halMillis() + pendingDuration;
+}
 
-  lcd.setCursor(0, 1);
-  lcd.print("                ");
-  lcd.setCursor(0, 1);
-  lcd.print(tempLine2);
+// Draw the temporary message into the LCD frame.
+// The lcdflush task puts the changed cells on the glass within the next passes of loop().
+void drawTempMessage() {
+  lcdFrame.clear();
+  lcdFrame.setCursor(0, 0);
+  lcdFrame.print(tempLine1);
+  lcdFrame.setCursor(0, 1);
+  lcdFrame.print(tempLine2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 //Windows-XP-style startup SFX sound for when we boot the device
-// Plays during the welcome message
-void playStartupMelody() {
-  tone(3, 392, 180); delay(220); // G4
-  tone(3, 523, 180); delay(220); // C5
-  tone(3, 659, 220); delay(260); // E5
-  tone(3, 784, 300); delay(340); // G5
-  tone(3, 659, 260); delay(300); // E5
-  noTone(3);
-}
+// Plays during the welcome message (now in the background, see melody.h)
+const MelodyNote startupMelody[] PROGMEM = {
+  { 392, 180, 220 }, // G4
+  { 523, 180, 220 }, // C5
+  { 659, 220, 260 }, // E5
+  { 784, 300, 340 }, // G5
+  { 659, 260, 300 }, // E5
+};
+
+// Simple melody for the rain alert
+const MelodyNote rainMelody[] PROGMEM = {
+  { 262, 200, 250 }, // C
+  { 294, 200, 250 }, // D
+  { 330, 200, 250 }, // E
+  { 349, 200, 250 }, // F
+};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
-// STARTUP SEQUENCE
-bool startupDone = false;
-int startupStep = 0;
-unsigned long startupStepUntil = 0;
+// STARTUP SEQUENCE (fast boot)
+// setup() brings everything up at once and starts the scheduler, so commands are accepted
+// a few ms after the reset. Only the servo attach stays staggered (each servo pulls a current
+// spike from the batteries), that and the LED test run in the boot task next to everything else.
+// The welcome melody is played at the end, when the servos are done.
+//
+//   0 ms     door servo attached, LED test on
+//   300 ms   window servo attached, LED test off
+//   600 ms   "All ready", melody, BOOT line
+const unsigned long bootServoGapMs = 300;
+const unsigned long bootSettleMs = 300;   // batteries recover from the second attach
+
+enum BootStep { BOOT_DOOR, BOOT_WINDOW, BOOT_SETTLE, BOOT_DONE };
+BootStep bootStep = BOOT_DOOR;
+unsigned long bootStepAt = 0;
+bool bootLedTest = false;
+
+// Boot timing for the BOOT line (ms since the sketch started)
+unsigned long bootSerialMs = 0;   // end of setup(): commands are accepted from here on
+unsigned long bootServosMs = 0;   // last servo attached
+unsigned long bootReadyMs = 0;    // boot task finished
+unsigned long firstCommandMs = 0; // first command applied (0 = none yet)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // ========================= GAS ALERT LOGIC =========================
@@ -154,24 +381,39 @@ unsigned long startupStepUntil = 0;
 // After any needed extra events finish:
 // - We return to "!! GAS ALERT !!" display and SOLID buzzer while gas is still high.
 // - When gas ends, we stop the buzzer and LCD goes back to normal.
+//
+// The steps are rows of gasRows[] (further down, next to the rain alert table), run by the
+// table engine in state_machine.h once per tick of the gas task:
+//
+//   idle --gas rises--> alert --3 s--> open_vent --3 s--> vent --3 s--> steady (re-shown every 1 s)
+//                             \-------> open --3 s--------------------/
+//                              \------> vent
+//                               \-----> steady (house open + fan on)
+//   any state --gas gone--> idle
+//
+// Every change of state is reported on the serial link, e.g. "EV gas alert>open_vent 9200"
 
-bool gasSequenceActive = false;     // remembers state (we are inside a gas event)
+enum GasState { GAS_IDLE, GAS_ALERT, GAS_OPEN_THEN_VENT, GAS_OPENING, GAS_VENTING, GAS_STEADY, GAS_STATE_COUNT };
+
+Fsm gasFsm;
 bool gasWasHigh = false;            // edge detection for gas event start
-unsigned long gasStageUntil = 0;    // timer used for each stage
 
-// The plan decided AFTER the first 3 seconds
-enum GasPlan { PLAN_NONE, PLAN_ONLY_ALERT, PLAN_VENT_ONLY, PLAN_OPEN_ONLY, PLAN_OPEN_THEN_VENT };
-GasPlan gasPlan = PLAN_NONE;
+// We are inside a gas event (the gas alarm owns the buzzer and the LCD)
+bool gasAlarmActive() {
+  return gasFsm.state != GAS_IDLE;
+}
+
+// Rain alert: dry -> wet when the steam sensor sees water, wet -> dry when it is gone
+enum RainState { RAIN_DRY, RAIN_WET, RAIN_STATE_COUNT };
+
+Fsm rainFsm;
 
-// Stages:
-// 0 = initial 3 seconds GAS ALERT with SOLID buzzer (NO extra actions)
-// 1 = opening step (if needed) with beep-beep 3s
-// 2 = ventilator step (if needed) with beep-beep 3s
-// 3 = steady GAS ALERT while gas remains high (SOLID buzzer)
-int gasPlanStage = 0;
+extern const FsmDef gasFsmDef;    // the tables are further down
+extern const FsmDef rainFsmDef;
 
 // Buzzer mode controller so nothing else can interrupt gas alarm beeps
-enum BuzzerMode { BUZZ_OFF, BUZZ_SOLID, BUZZ_SIREN };
+// BUZZ_MELODY = a song from the melody engine is playing (lowest priority, anything else cuts it off)
+enum BuzzerMode { BUZZ_OFF, BUZZ_SOLID, BUZZ_SIREN, BUZZ_MELODY };
 BuzzerMode buzzerMode = BUZZ_OFF;
 bool manualBuzzerOn = false;
 
@@ -193,7 +435,7 @@ void updateSiren(bool enableAlarmClockBeep) {
   // but in practice here we only changed the sound system and we did't touch anything else in the code's logic.
   if (!enableAlarmClockBeep) {
     if (alarmBeepActive) {
-      noTone(3);
+      halNoTone(PIN_BUZZER.pin);
     }
     alarmBeepActive = false;
     alarmBeepOn = false;
@@ -209,28 +451,28 @@ void updateSiren(bool enableAlarmClockBeep) {
     alarmBeepStep = 0;
   }
 
-  if (alarmBeepNextToggle == 0 || millis() >= alarmBeepNextToggle) {
+  if (alarmBeepNextToggle == 0 || halMillis() >= alarmBeepNextToggle) {
 
     // alarmBeepStep cycles: 0=beep1 ON, 1=beep1 OFF, 2=beep2 ON, 3=beep2 OFF (long gap)
     if (alarmBeepStep == 0) {
-      tone(3, alarmBeepFreq);
+      halTone(PIN_BUZZER.pin, alarmBeepFreq, 0);
       alarmBeepOn = true;
-      alarmBeepNextToggle = millis() + alarmOnMs;
+      alarmBeepNextToggle = halMillis() + alarmOnMs;
     }
     else if (alarmBeepStep == 1) {
-      noTone(3);
+      halNoTone(PIN_BUZZER.pin);
       alarmBeepOn = false;
-      alarmBeepNextToggle = millis() + alarmOffMs;
+      alarmBeepNextToggle = halMillis() + alarmOffMs;
     }
     else if (alarmBeepStep == 2) {
-      tone(3, alarmBeepFreq);
+      halTone(PIN_BUZZER.pin, alarmBeepFreq, 0);
       alarmBeepOn = true;
-      alarmBeepNextToggle = millis() + alarmOnMs;
+      alarmBeepNextToggle = halMillis() + alarmOnMs;
     }
     else { // alarmBeepStep == 3
-      noTone(3);
+      halNoTone(PIN_BUZZER.pin);
       alarmBeepOn = false;
-      alarmBeepNextToggle = millis() + alarmGapMs;
+      alarmBeepNextToggle = halMillis() + alarmGapMs;
     }
 
     alarmBeepStep++;
@@ -238,596 +480,1174 @@ void updateSiren(bool enableAlarmClockBeep) {
   }
 }
 
+// Starts a melody if nothing more important owns the buzzer
+void playMelody(const MelodyNote* notes, uint8_t count) {
+  if (buzzerMode == BUZZ_SOLID || buzzerMode == BUZZ_SIREN) return;
+  melodyStart(PIN_BUZZER.pin, notes, count);
+  buzzerMode = BUZZ_MELODY;
+}
+
+// What the buzzer does when the gas alarm is not using it
+BuzzerMode idleBuzzerMode() {
+  if (melodyActive()) return BUZZ_MELODY;
+  return manualBuzzerOn ? BUZZ_SIREN : BUZZ_OFF;
+}
+
 // Apply buzzer output based on mode (single owner of buzzer)
 // BUZZ_SOLID uses the original style that Ryad had (digitalWrite HIGH)
 // BUZZ_SIREN uses the alarm clock style beep I came up with (Dani SG4)
+// BUZZ_MELODY lets the melody engine step through its notes
 void applyBuzzerMode() {
+  PERF_SCOPE(PERF_BUZZER);
+  // A melody only keeps playing while it owns the buzzer, so the gas alarm pre-empts it right away
+  if (buzzerMode != BUZZ_MELODY) {
+    melodyStop();
+  }
+
   if (buzzerMode == BUZZ_OFF) {
     updateSiren(false);
-    digitalWrite(3, LOW);
+    halDigitalWrite(PIN_BUZZER.pin, LOW);
   }
   else if (buzzerMode == BUZZ_SOLID) {
     // Important: stop tone so it can't interfere with solid pin HIGH
     updateSiren(false);
-    noTone(3);
-    digitalWrite(3, HIGH);
+    halNoTone(PIN_BUZZER.pin);
+    halDigitalWrite(PIN_BUZZER.pin, HIGH);
   }
   else if (buzzerMode == BUZZ_SIREN) {
     // Important: keep pin LOW so tone output is clean
-    digitalWrite(3, LOW);
+    halDigitalWrite(PIN_BUZZER.pin, LOW);
     updateSiren(true);
   }
+  else if (buzzerMode == BUZZ_MELODY) {
+    updateSiren(false);
+    melodyUpdate();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// IDLE SLEEP
+// Between two passes the CPU sleeps until the next interrupt instead of spinning. The Timer0
+// tick wakes it every ~1 ms, so no task starts later than before, and a byte from the gateway
+// or a button / PIR edge wakes it right away, so commands are not slower either.
+// Some of the houses run on batteries, SLEEP? tells how much of the time the CPU is awake.
+unsigned long sleepStatsMs = 0;   // halMillis() of the last SLEEP! (or power on)
+unsigned long sleepCount = 0;
+unsigned long sleptMs = 0;
+unsigned long sleptUsPart = 0;    // the part of a millisecond not yet in sleptMs
+
+// Anything that has to run on the next pass instead of the next tick
+bool stayAwake() {
+  return schedulerDue() || inputsPending() || halSerialAvailable() > 0 ||
+         serialOut.wantsToSend() || lcdFrame.dirty();
+}
+
+void idleSleep() {
+  unsigned long start = halMicros();
+  if (!halIdleSleep(stayAwake)) return;
+
+  sleepCount++;
+  sleptUsPart += halMicros() - start;
+  sleptMs += sleptUsPart / 1000;
+  sleptUsPart %= 1000;
+}
+
+// SLEEP? answer (single line)
+bool sleepReportLine(Print& out, uint8_t index) {
+  if (index > 0) return false;
+
+  unsigned long totalMs = halMillis() - sleepStatsMs;
+  unsigned long awakeMs = totalMs > sleptMs ? totalMs - sleptMs : 0;
+  unsigned long permille = totalMs >= 1000 ? awakeMs / (totalMs / 1000) : 1000;
+  if (permille > 1000) permille = 1000;
+
+  out.print(F("SLEEP awake_pct="));
+  out.print(permille / 10);
+  out.print('.');
+  out.print(permille % 10);
+  out.print(F(" awake_ms="));
+  out.print(awakeMs);
+  out.print(F(" slept_ms="));
+  out.print(sleptMs);
+  out.print(F(" sleeps="));
+  out.println(sleepCount);
+  return true;
+}
+
+void sleepResetStats() {
+  sleepStatsMs = halMillis();
+  sleepCount = 0;
+  sleptMs = 0;
+  sleptUsPart = 0;
 }
 
 /////////////////////////////////
 // PROGRAM
 
 void setup() {
-  Serial.begin(9600); // Start serial for VSC monitor
-  lcd.init();
-  lcd.backlight();
-  
-  // Output Pins
-  pinMode(5, OUTPUT);  // Yellow LED
-  pinMode(13, OUTPUT); // White LED
-  pinMode(7, OUTPUT);  // Fan (INA)
-  pinMode(6, OUTPUT);  // Fan (INB)
-  pinMode(12, OUTPUT); // Relay
-  pinMode(3, OUTPUT);  // Buzzer
+  halSerialBegin(LINK_BOOT_BAUD); // Start serial for VSC monitor (BAUD <rate> can go faster later)
+  lineReset(serialLine);
+  serialOut.begin(renderState);
+  halLcdInit();
+  lcdFrame.begin();
   
-  // Input Pins
-  pinMode(4, INPUT);   // Button 1
-  pinMode(8, INPUT);   // Button 2
-  pinMode(2, INPUT);   // PIR Motion
-
-  // NEW: Force everything OFF immediately at boot to avoid "everything turns on automatically at the same time"
-  digitalWrite(5, LOW);  
-  digitalWrite(13, LOW); 
-  digitalWrite(7, LOW);  
-  digitalWrite(6, LOW);  
-  digitalWrite(12, LOW); 
-  digitalWrite(3, LOW);  
-  noTone(3);
-
-  // NEW: Welcome message that stays during staged startup
-  tempLine1 = "Welcome! Turning";
-  tempLine2 = "the device on...";
-  messageUntil = millis() + 99999999UL; // keep welcome message until startup finishes
-  forceShowTempMessageNow();
-
-  // NEW: play startup melody during the welcome message
-  playStartupMelody();
-
-  // NEW: Start the staged startup steps
-  startupDone = false;
-  startupStep = 0;
-  startupStepUntil = millis();
+  // Output and input pins (see pins.h), everything OFF right away
+  // to avoid "everything turns on automatically at the same time"
+  pinsBegin();
+  halNoTone(PIN_BUZZER.pin);
+
+  // Analog sensors (A0 gas, A1 light, A2 soil, A3 steam) are sampled in the background
+  adcBegin();
+
+  fsmBegin(gasFsm, gasFsmDef);
+  fsmBegin(rainFsm, rainFsmDef);
+  gasWasHigh = false;
+
+  // Automation rules uploaded earlier
+  rulesBegin();
+
+  // Come back the way we were before the reset (journal.h). Lights always,
+  // door/window/fans/buzzer only with J:1, otherwise they start in the safe state.
+  journalBegin(bootStateBits);
+  restoreAll = (bootStateBits & JOURNAL_RESTORE_ALL) != 0;
+  whiteLightOn = (bootStateBits & STATE_BIT_WHITE_LIGHT) != 0;
+  orangeLightOn = (bootStateBits & STATE_BIT_ORANGE_LIGHT) != 0;
+  doorOpen = restoreAll && (bootStateBits & STATE_BIT_DOOR);
+  windowOpen = restoreAll && (bootStateBits & STATE_BIT_WINDOW);
+  fan_ina_on = restoreAll && (bootStateBits & STATE_BIT_FAN_INA);
+  fan_inb_on = restoreAll && (bootStateBits & STATE_BIT_FAN_INB);
+  manualBuzzerOn = restoreAll && (bootStateBits & STATE_BIT_BUZZER);
+  buzzerMode = idleBuzzerMode();
+
+  // Servos start where the journal left them (attached later by the boot task)
+  servoInit(doorServo, DOOR_SERVO, PIN_DOOR_SERVO.pin, servoProfile, doorOpen ? servoOpenAngle : servoClosedAngle);
+  servoInit(windowServo, WINDOW_SERVO, PIN_WINDOW_SERVO.pin, servoProfile, windowOpen ? servoOpenAngle : servoClosedAngle);
+
+  // NEW: Welcome message that stays until the boot task is done
+  showTempMessage(F("Welcome! Turning"), F("the device on..."), MSG_INFO, 99999999UL);
+
+  // Everything else runs as tasks from here on, the boot task included
+  inputsBegin();
+  schedulerBegin(tasks, taskState, TASK_COUNT);
+  bootStep = BOOT_DOOR;
+  bootStepAt = halMillis();
+  bootSerialMs = halMillis();
 }
 
 void loop() {
-  // Request a normal LCD refresh only 2 times per second (reduces flicker)
-  if (millis() - lastSensorLcdUpdate >= sensorLcdInterval) {
-    lastSensorLcdUpdate = millis();
-    lcdNeedsUpdate = true;
-  }
-
-  //////////////////////////////////////////////////////////////////////////////////////////////////
-  // NEW: staged startup (ONE FEATURE AT A TIME)
-  if (!startupDone) {
-
-    if (millis() >= startupStepUntil) {
-
-      if (startupStep == 0) {
-        // Step 0: baseline off + stable variables
-        digitalWrite(5, LOW);  
-        digitalWrite(13, LOW); 
-        digitalWrite(7, LOW);  
-        digitalWrite(6, LOW);  
-        digitalWrite(12, LOW); 
-        digitalWrite(3, LOW);  
-        noTone(3);
-
-        // Ensure safe default states
-        doorOpen = false;
-        windowOpen = false;
-        fan_ina_on = false;
-        fan_inb_on = false;
-        manualBuzzerOn = false;
-        songPlayed = false;
-
-        // Reset gas system
-        gasSequenceActive = false;
-        gasWasHigh = false;
-        gasPlan = PLAN_NONE;
-        gasPlanStage = 0;
-        gasStageUntil = 0;
-
-        buzzerMode = BUZZ_OFF;
-        applyBuzzerMode();
-
-        startupStep++;
-        startupStepUntil = millis() + 400;
-      }
-      else if (startupStep == 1) {
-        // Step 1: attach servos (only now, not instantly at boot)
-        doorServo.attach(9);  //
-        windowServo.attach(10); //
-        doorServo.write(0);
-        windowServo.write(0);
-
-        startupStep++;
-        startupStepUntil = millis() + 600; // give batteries time to recover from servo attach
-      }
-      else if (startupStep == 2) {
-        // Step 2: tiny LED test (low current)
-        digitalWrite(13, HIGH);
-        startupStep++;
-        startupStepUntil = millis() + 300;
-      }
-      else if (startupStep == 3) {
-        // Step 3: LED off
-        digitalWrite(13, LOW);
-        startupStep++;
-        startupStepUntil = millis() + 300;
-      }
-      else if (startupStep == 4) {
-        // Step 4: fan remains OFF (we just confirm stable state)
-        digitalWrite(7, LOW);  
-        digitalWrite(6, LOW);
-        startupStep++;
-        startupStepUntil = millis() + 300;
-      }
-      else if (startupStep == 5) {
-        // Step 5: relay remains OFF (we just confirm stable state)
-        digitalWrite(12, LOW);
-        startupStep++;
-        startupStepUntil = millis() + 300;
-      }
-      else if (startupStep == 6) {
-        // Startup finished
-        startupDone = true;
-        showTempMessage("All ready", "");
-        forceShowTempMessageNow();
-      }
+  // No more delay(200): every part of the program is a task with its own period (see TASK TABLE).
+  {
+    PERF_SCOPE(PERF_LOOP);
+    schedulerRun();
+  }
+  idleSleep();
+}
+
+// BOOT line (sent once when the boot task is done, and again on BOOT?)
+bool bootReportLine(Print& out, uint8_t index) {
+  if (index > 0) return false;
+
+  out.print(F("BOOT serial_ms="));
+  out.print(bootSerialMs);
+  out.print(F(" servos_ms="));
+  out.print(bootServosMs);
+  out.print(F(" ready_ms="));
+  out.print(bootReadyMs);
+  out.print(F(" first_cmd_ms="));
+  out.println(firstCommandMs);
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: boot steps that have to wait (every 10 ms until done, see STARTUP SEQUENCE)
+void taskBoot() {
+  if (bootStep == BOOT_DONE) return;
+  unsigned long now = halMillis();
+  if (now < bootStepAt) return;
+
+  if (bootStep == BOOT_DOOR) {
+    // We don't know where the horn really is, so it is driven to the restored
+    // position once and let go after it settled
+    servoSync(doorServo, now);
+    bootLedTest = true;   // tiny LED test (low current)
+
+    bootStep = BOOT_WINDOW;
+    bootStepAt = now + bootServoGapMs;
+  }
+  else if (bootStep == BOOT_WINDOW) {
+    servoSync(windowServo, now);
+    bootLedTest = false;
+    bootServosMs = now;
+
+    bootStep = BOOT_SETTLE;
+    bootStepAt = now + bootSettleMs;
+  }
+  else {
+    bootStep = BOOT_DONE;
+    bootReadyMs = now;
+
+    // Only replaces the welcome message, not something a command or an alarm put there
+    if (tempPriority == MSG_INFO && messageUntil > now + 60000UL) {
+      showTempMessage(F("All ready"), F(""));
     }
+    // The welcome melody, deferred to here so it does not hold up the boot
+    playMelody(startupMelody, sizeof(startupMelody) / sizeof(startupMelody[0]));
 
-    // Keep welcome/all-ready message behavior and DO NOT run the rest of the system during startup
-    return;
+    serialOut.startReport(bootReportLine);
   }
+}
 
-  //////////////////////////////////////////////////////////////////////////////////////////////////
-  // NORMAL PROGRAM AFTER STARTUP
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// SERIAL COMMANDS
+// Argument for switch style commands: none = toggle, :1 = on/open, :0 = off/close.
+// Returns false (and changes nothing) for any other number (checkShortCommand() refuses those first).
+bool applySwitchArg(const Command& cmd, bool& state) {
+  if (!cmd.hasArg) {
+    state = !state;
+    return true;
+  }
+  if (cmd.arg > 1) return false;
+  state = (cmd.arg == 1);
+  return true;
+}
 
-  //bluetooth instructions
-  while (Serial.available()) {
-  char c = Serial.read();
-
-  if (c == '\r') continue;     
-  if (c == '\n') {              
-    if (serialBuf.length() > 0) {
-
-      // Toggle fan INA (pin 7)
-      if (serialBuf == "X") {
-        fan_ina_on = !fan_ina_on;
-        showTempMessage("Fan INA", fan_ina_on ? "ON" : "OFF");
-        forceShowTempMessageNow();
-      }
+// LCD message: M<line1>|<line2>
+void showSplitText(const char* text, uint8_t len) {
+  char line1[17];
+  char line2[17];
+  uint8_t n1 = 0;
+  uint8_t n2 = 0;
+  bool second = false;
+
+  for (uint8_t i = 0; i < len; i++) {
+    char c = text[i];
+    if (c == '|' && !second) { second = true; continue; }
+
+    // 16x2: trimma
+    if (!second && n1 < 16) line1[n1++] = c;
+    if (second && n2 < 16)  line2[n2++] = c;
+  }
+  line1[n1] = '\0';
+  line2[n2] = '\0';
 
-      // Toggle fan INB (pin 6)
-      else if (serialBuf == "Y") {
-        fan_inb_on = !fan_inb_on;
-        showTempMessage("Fan INB", fan_inb_on ? "ON" : "OFF");
-        forceShowTempMessageNow();
-      }
+  showTempMessage(line1, line2);
+}
 
-      // Door command: D (toggle), D:1 (open), D:0 (close)
-      else if (serialBuf == "D" || serialBuf == "D:1" || serialBuf == "D:0") {
-        if (serialBuf == "D:1") {
-          doorOpen = true;
-        } else if (serialBuf == "D:0") {
-          doorOpen = false;
-        } else {
-          doorOpen = !doorOpen;
-        }
-        showTempMessage("Door", doorOpen ? "OPEN" : "CLOSE");
-        forceShowTempMessageNow();
-      }
+void showLcdText(const Command& cmd) {
+  showSplitText(cmd.text, cmd.textLen);
+}
 
-      // Window command: N (toggle), N:1 (open), N:0 (close)
-      else if (serialBuf == "N" || serialBuf == "N:1" || serialBuf == "N:0") {
-        if (serialBuf == "N:1") {
-          windowOpen = true;
-        } else if (serialBuf == "N:0") {
-          windowOpen = false;
-        } else {
-          windowOpen = !windowOpen;
-        }
-        showTempMessage("Window", windowOpen ? "OPEN" : "CLOSE");
-        forceShowTempMessageNow();
-      }
+// TXQ? answer (single line)
+bool txqReportLine(Print& out, uint8_t index) {
+  if (index > 0) return false;
+
+  const SerialOutStats& q = serialOut.stats();
+  out.print(F("TXQ sent="));
+  out.print(q.bytesSent);
+  out.print(F(" dropped_urgent="));
+  out.print(q.droppedUrgent);
+  out.print(F(" dropped_debug="));
+  out.print(q.droppedDebug);
+  out.print(F(" merged_state="));
+  out.print(q.mergedState);
+  out.print(F(" truncated_state="));
+  out.println(q.truncatedState);
+  return true;
+}
 
-      // Buzzer command: B (toggle), B:1 (on), B:0 (off)
-      else if (serialBuf == "B" || serialBuf == "B:1" || serialBuf == "B:0") {
-        if (serialBuf == "B:1") {
-          manualBuzzerOn = true;
-          showTempMessage("Buzzer", "ON");
-        } else if (serialBuf == "B:0") {
-          manualBuzzerOn = false;
-          showTempMessage("Buzzer", "OFF");
-        } else {
-          manualBuzzerOn = !manualBuzzerOn;
-          if (manualBuzzerOn) {
-            showTempMessage("Buzzer", "ON");
-          } else {
-            showTempMessage("Buzzer", "OFF");
-          }
-        }
-        if (!gasSequenceActive) {
-          buzzerMode = manualBuzzerOn ? BUZZ_SIREN : BUZZ_OFF;
-        }
-        forceShowTempMessageNow();
-      }
+// MEM? answer (single line): free RAM now, lowest free RAM ever (stack high-water), heap break
+bool memReportLine(Print& out, uint8_t index) {
+  if (index > 0) return false;
+
+  HalMemInfo mem;
+  halMemInfo(mem);
+  out.print(F("MEM free="));
+  out.print(mem.freeNow);
+  out.print(F(" min_free="));
+  out.print(mem.freeMin);
+  out.print(F(" heap_brk="));
+  out.print(mem.heapBreak);
+  out.print(F(" static="));
+  out.println(mem.staticBytes);
+  return true;
+}
 
-      // Toggle white light
-      else if (serialBuf == "W") {
-        whiteLightOn = !whiteLightOn;
-        showTempMessage("White Light", whiteLightOn ? "ON" : "OFF");
-        forceShowTempMessageNow();
-      }
+// Counted by onInputEvent()
+unsigned long inputEvents = 0;
+unsigned long inputLongPresses = 0;   // buttons held for INPUT_LONG_PRESS_MS
+unsigned long inputLagMaxUs = 0;      // edge -> handled, debounce time included (INPUT?)
+
+// INPUT? answer (single line): button / PIR events so far, how many of them were long
+// presses, the slowest one from its edge to the handler, and edges lost because the queue
+// was full
+bool inputReportLine(Print& out, uint8_t index) {
+  if (index > 0) return false;
+
+  out.print(F("INPUT events="));
+  out.print(inputEvents);
+  out.print(F(" long="));
+  out.print(inputLongPresses);
+  out.print(F(" lag_max_us="));
+  out.print(inputLagMaxUs);
+  out.print(F(" dropped="));
+  out.println(inputsDropped());
+  return true;
+}
 
-      // Toggle orange light
-      else if (serialBuf == "O") {
-        orangeLightOn = !orangeLightOn;
-        showTempMessage("Orange Light", orangeLightOn ? "ON" : "OFF");
-        forceShowTempMessageNow();
-      }
+// Diagnostic words (SCHED? ...). Returns false if the word is unknown.
+bool runWordCommand(const Command& cmd) {
+  // Scheduler statistics: SCHED? (report), SCHED! (reset counters)
+  if (cmdWordIs(cmd, PSTR("SCHED"))) {
+    if (cmd.op == '?') serialOut.startReport(schedulerReportLine);
+    else               schedulerResetStats();
+    return true;
+  }
+  // Boot timing: BOOT?
+  if (cmdWordIs(cmd, PSTR("BOOT"))) {
+    if (cmd.op == '?') serialOut.startReport(bootReportLine);
+    return true;
+  }
+  // State journal: JNL?
+  if (cmdWordIs(cmd, PSTR("JNL"))) {
+    if (cmd.op == '?') serialOut.startReport(journalReportLine);
+    return true;
+  }
+  // CPU duty cycle: SLEEP? (report), SLEEP! (reset counters)
+  if (cmdWordIs(cmd, PSTR("SLEEP"))) {
+    if (cmd.op == '?') serialOut.startReport(sleepReportLine);
+    else               sleepResetStats();
+    return true;
+  }
+  // LCD!: set the display up again (e.g. garbled by I2C noise) and redraw every cell. The
+  // init itself waits ~50 ms, that's fine for something done by hand.
+  if (cmdWordIs(cmd, PSTR("LCD"))) {
+    if (cmd.op == '!') {
+      halLcdInit();
+      lcdFrame.invalidate();
+      requestLcdRedraw();
+    }
+    return true;
+  }
+  // Memory usage: MEM?
+  if (cmdWordIs(cmd, PSTR("MEM"))) {
+    if (cmd.op == '?') serialOut.startReport(memReportLine);
+    return true;
+  }
+  // Section timings: PERF? (report), PERF! (reset). Only in builds with -DPERF_PROBES.
+  if (cmdWordIs(cmd, PSTR("PERF"))) {
+#if defined(PERF_PROBES)
+    if (cmd.op == '?') serialOut.startReport(perfReportLine);
+    else               perfReset();
+#else
+    serialOut.beginMessage(OUT_URGENT);
+    serialOut.println(F("PERF off"));
+    serialOut.endMessage();
+#endif
+    return true;
+  }
+  // Automation rules: RULE? (report), RULE! (start an upload, see rules.h)
+  if (cmdWordIs(cmd, PSTR("RULE"))) {
+    if (cmd.op == '?') {
+      serialOut.startReport(rulesReportLine);
+    } else {
+      bool started = rulesLoadStart();
+      serialOut.beginMessage(OUT_URGENT);
+      serialOut.println(started ? F("RULE load") : F("RULE busy"));
+      serialOut.endMessage();
+    }
+    return true;
+  }
+  // Outbound queue counters: TXQ? (report), TXQ! (reset counters)
+  if (cmdWordIs(cmd, PSTR("TXQ"))) {
+    if (cmd.op == '?') serialOut.startReport(txqReportLine);
+    else               serialOut.resetStats();
+    return true;
+  }
+  // Input events: INPUT?
+  if (cmdWordIs(cmd, PSTR("INPUT"))) {
+    if (cmd.op == '?') serialOut.startReport(inputReportLine);
+    return true;
+  }
+  return false;
+}
 
-      // LCD message: M<line1>|<line2>
-      else if (serialBuf.startsWith("M")) {
-        String msg = serialBuf.substring(1);
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// COMMAND ACKNOWLEDGEMENTS
+// A command that ends in #<seq> (see command_parser.h) gets an answer, one without stays
+// silent like before:
+//   ACK <seq> <rx_us> <applied_us>   rx_us = micros() when its line was complete,
+//                                    applied_us = micros() once the outputs task wrote the pins
+//                                    (and handed the servos their new target)
+//   NAK <seq> <reason>               nothing was changed: parse, unknown, arg or too_long
+// An ACK means "accepted and applied", not "finished": after D / N (also D:x, N:x or an S=
+// frame that moves them) the door or window has only just started moving. With servoProfile
+// that takes up to about a second more (the window starts 250 ms after the door). STATE says
+// open/close from the ACK on, nothing reports when the horn arrives.
+// The gateway sends a command again with the same seq when no answer came. If that is the seq
+// acknowledged last, the ACK is repeated and the command is NOT run again (a lost ACK must
+// not make a toggle toggle twice).
+
+enum CmdResult { CMD_OK, CMD_ERR_PARSE, CMD_ERR_UNKNOWN, CMD_ERR_ARG, CMD_ERR_TOO_LONG };
+
+// NAK reasons, same order as CmdResult
+const char nakReasons[][9] PROGMEM = { "", "parse", "unknown", "arg", "too_long" };
+
+struct PendingAck {
+  uint16_t seq;
+  unsigned long rxUs;
+};
+
+// Commands of this pass waiting for the outputs task. When it is full serial ingest stops,
+// the remaining bytes wait in the UART buffer until the next pass.
+const uint8_t ACK_QUEUE_SIZE = 4;
+PendingAck pendingAcks[ACK_QUEUE_SIZE];
+uint8_t pendingAckCount = 0;
+
+bool lastAckValid = false;
+uint16_t lastAckSeq = 0;
+unsigned long lastAckRxUs = 0;
+unsigned long lastAckAppliedUs = 0;
+
+void sendAck(uint16_t seq, unsigned long rxUs, unsigned long appliedUs) {
+  serialOut.beginMessage(OUT_URGENT);
+  serialOut.print(F("ACK "));
+  serialOut.print((unsigned int)seq);
+  serialOut.print(' ');
+  serialOut.print(rxUs);
+  serialOut.print(' ');
+  serialOut.println(appliedUs);
+  serialOut.endMessage();
+}
 
-        String line1 = msg;
-        String line2 = "";
+void sendNak(uint16_t seq, CmdResult result) {
+  serialOut.beginMessage(OUT_URGENT);
+  serialOut.print(F("NAK "));
+  serialOut.print((unsigned int)seq);
+  serialOut.print(' ');
+  serialOut.println((const __FlashStringHelper*)nakReasons[result]);
+  serialOut.endMessage();
+}
 
-        int sep = msg.indexOf('|');
-        if (sep >= 0) {
-          line1 = msg.substring(0, sep);
-          line2 = msg.substring(sep + 1);
-        }
+// A resent command that was already run: answer again, don't run it
+bool repeatedCommand(const Command& cmd) {
+  if (!cmd.hasSeq) return false;
+  if (lastAckValid && cmd.seq == lastAckSeq) {
+    sendAck(lastAckSeq, lastAckRxUs, lastAckAppliedUs);
+    return true;
+  }
+  for (uint8_t i = 0; i < pendingAckCount; i++) {
+    if (pendingAcks[i].seq == cmd.seq) return true;   // its ACK goes out this pass anyway
+  }
+  return false;
+}
 
-        // 16x2: trimma
-        if (line1.length() > 16) line1 = line1.substring(0, 16);
-        if (line2.length() > 16) line2 = line2.substring(0, 16);
+void commandDone(const Command& cmd, CmdResult result, unsigned long rxUs) {
+  if (!cmd.hasSeq) return;
+  if (result != CMD_OK) {
+    sendNak(cmd.seq, result);
+    return;
+  }
+  pendingAcks[pendingAckCount].seq = cmd.seq;
+  pendingAcks[pendingAckCount].rxUs = rxUs;
+  pendingAckCount++;
+}
 
-        showTempMessage(line1, line2);
-        forceShowTempMessageNow();
-      }
-    }
+// Called by the outputs task right after the pins were written
+void sendPendingAcks() {
+  if (pendingAckCount == 0) return;
 
-    serialBuf = ""; // reset
-  } else {
-    if (serialBuf.length() < 80) serialBuf += c; // protection against to big serialbuf
+  unsigned long appliedUs = halMicros();
+  for (uint8_t i = 0; i < pendingAckCount; i++) {
+    sendAck(pendingAcks[i].seq, pendingAcks[i].rxUs, appliedUs);
   }
+  lastAckValid = true;
+  lastAckSeq = pendingAcks[pendingAckCount - 1].seq;
+  lastAckRxUs = pendingAcks[pendingAckCount - 1].rxUs;
+  lastAckAppliedUs = appliedUs;
+  pendingAckCount = 0;
 }
-  // Read all sensors
-  int gas = analogRead(A0);
-  int light = analogRead(A1);
-  int soil = analogRead(A2);
-  int steam = analogRead(A3);
-  int motion = digitalRead(2);
-  int btn1 = digitalRead(4);
-  int btn2 = digitalRead(8);
 
-  // --- 2. GAS ALARM TEST ---
-  bool gasHigh = (gas > gasThreshold);
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// SERIAL LINK SPEED
+// The link always comes up at 9600 (a gateway that knows nothing else still works). The
+// gateway can ask for more:
+//   BAUD 115200  -> "BAUD switch 115200", still on the old rate. The board switches as soon
+//                   as everything queued before it (ACK included) is out.
+//   BAUD?        -> "BAUD 115200". Sent on the new rate it is the probe that confirms it.
+// If no probe gets through within LINK_PROBE_MS after the switch, the board goes back to
+// 9600 by itself and says "BAUD fallback 9600" there; the gateway goes back as well when its
+// probes stay unanswered. A rate the board can't do gets "BAUD err <rate>", nothing changes.
+// The rate is never saved, after a reset it is LINK_BOOT_BAUD again.
+const unsigned long LINK_PROBE_MS = 1000;
+
+// Rates the UART hits closely enough at 16 MHz
+const uint32_t linkRates[] PROGMEM = { 9600, 57600, 115200, 250000 };
+
+enum LinkState { LINK_STEADY, LINK_DRAINING, LINK_PROBING };
+LinkState linkState = LINK_STEADY;
+unsigned long linkBaud = LINK_BOOT_BAUD;
+unsigned long linkNewBaud = LINK_BOOT_BAUD;
+unsigned long linkSwitchMs = 0;
+
+void linkAnswer(const __FlashStringHelper* what, unsigned long baud) {
+  serialOut.beginMessage(OUT_URGENT);
+  serialOut.print(F("BAUD "));
+  serialOut.print(what);
+  serialOut.println(baud);
+  serialOut.endMessage();
+}
 
-  // ========================= GAS ALERT EXECUTION =========================
+bool linkRateSupported(uint32_t baud) {
+  for (uint8_t i = 0; i < sizeof(linkRates) / sizeof(linkRates[0]); i++) {
+    if (pgm_read_dword(&linkRates[i]) == baud) return true;
+  }
+  return false;
+}
 
-  // Start the gas event only once when gas becomes high (rising edge)
-  if (gasHigh && !gasWasHigh && !gasSequenceActive) {
+// BAUD <rate> / BAUD?
+CmdResult linkCommand(const Command& cmd) {
+  if (cmd.op == '?') {
+    linkState = LINK_STEADY;   // the probe got through (or there was nothing to confirm)
+    linkAnswer(F(""), linkBaud);
+    return CMD_OK;
+  }
+  if (cmd.op != ' ') return CMD_ERR_ARG;
 
-    gasSequenceActive = true;
+  if (!linkRateSupported(cmd.arg) || linkState != LINK_STEADY) {
+    linkAnswer(F("err "), cmd.arg);
+    return CMD_ERR_ARG;
+  }
+  linkAnswer(F("switch "), cmd.arg);
+  linkNewBaud = cmd.arg;
+  linkState = LINK_DRAINING;
+  return CMD_OK;
+}
 
-    // Stage 0 = FIRST 3 seconds ONLY: GAS ALERT + SOLID buzzer
-    gasPlanStage = 0;
-    gasStageUntil = millis() + 3000;
+// Changes the UART rate. Whatever came in around the switch is junk, drop it.
+void linkSetBaud(unsigned long baud) {
+  halSerialBegin(baud);
+  linkBaud = baud;
+  while (halSerialAvailable() > 0) halSerialRead();
+  lineReset(serialLine);
+}
+
+// Checks the argument of a short command without running it, so a batch can be refused
+// as a whole before any part of it ran
+CmdResult checkShortCommand(const Command& cmd) {
+  switch (cmd.op) {
+    // Toggle, :1 or :0 (see applySwitchArg)
+    case 'X': case 'Y': case 'F': case 'D': case 'N': case 'B': case 'W': case 'O':
+      return (cmd.hasArg && cmd.arg > 1) ? CMD_ERR_ARG : CMD_OK;
 
-    // Show GAS ALERT immediately
-    showTempMessage("!! GAS ALERT !!", "");
-    forceShowTempMessageNow();
+    // :1 or :0 required
+    case 'T': case 'J':
+      return (!cmd.hasArg || cmd.arg > 1) ? CMD_ERR_ARG : CMD_OK;
 
-    // Gas alert sound MUST be the old SOLID buzzer (Ryad)
-    buzzerMode = BUZZ_SOLID;
+    // :<byte> required
+    case 'R':
+      return (!cmd.hasArg || cmd.arg > 255) ? CMD_ERR_ARG : CMD_OK;
+
+    default:
+      return CMD_ERR_UNKNOWN;
+  }
+}
+
+CmdResult dispatchCommand(const Command& cmd);
+
+// Batch: D:1;N:1;X:1;W:1 (one #<seq> at the end, one ACK for all of it).
+// Every part is checked first and nothing runs unless all of them are fine. Then they all run
+// in this pass: the outputs task writes them in one go, the LCD gets one message instead of
+// one per part and one STATE goes out. (The window still starts 250 ms after the door,
+// see servoProfile.)
+// Only actuator commands go in a batch: R:<crc> ends a rule upload, T: switches the telemetry
+// format and J: the journal restore, none of that is part of a scene, so those are refused.
+CmdResult dispatchBatch(const Command& batch) {
+  uint8_t pos = 0;
+  for (;;) {
+    Command part = cmdBatchNext(batch, pos);
+    if (part.kind == CMD_EMPTY) break;
+    if (part.kind != CMD_SHORT) return CMD_ERR_PARSE;
+    if (part.op == 'R' || part.op == 'T' || part.op == 'J') return CMD_ERR_PARSE;
+
+    CmdResult result = checkShortCommand(part);
+    if (result != CMD_OK) return result;
+  }
 
-    // Plan not decided yet — we decide it AFTER these 3 seconds
-    gasPlan = PLAN_NONE;
+  pos = 0;
+  for (;;) {
+    Command part = cmdBatchNext(batch, pos);
+    if (part.kind == CMD_EMPTY) break;
+    dispatchCommand(part);
   }
 
-  // While gas sequence is active, we manage stages with IF statements + timers
-  if (gasSequenceActive) {
+  showTempMessage(F("Batch applied"), F(""));
+  return CMD_OK;
+}
+
+// Whole actuator state in one line: S=<hex byte>, same bits as the binary STATE frame
+// (STATE_BIT_* in telemetry_frame.h, the motion bit must be 0). Every actuator is set, not
+// toggled, so a gateway that (re)connects brings the house to the state it wants in one write,
+// and sending it twice does no harm. E.g. S=21 = door open + white light, everything else off.
+CmdResult applyStateFrame(const Command& cmd) {
+  if (cmd.textLen != 2) return CMD_ERR_ARG;
+  uint8_t bits = cmdDataByte(cmd, 0);
+  if (bits & STATE_BIT_MOTION) return CMD_ERR_ARG;
+
+  doorOpen = (bits & STATE_BIT_DOOR) != 0;
+  windowOpen = (bits & STATE_BIT_WINDOW) != 0;
+  fan_ina_on = (bits & STATE_BIT_FAN_INA) != 0;
+  fan_inb_on = (bits & STATE_BIT_FAN_INB) != 0;
+  whiteLightOn = (bits & STATE_BIT_WHITE_LIGHT) != 0;
+  orangeLightOn = (bits & STATE_BIT_ORANGE_LIGHT) != 0;
+
+  // Same as B:x, but a melody keeps playing when the buzzer bit didn't change
+  bool buzzer = (bits & STATE_BIT_BUZZER) != 0;
+  if (buzzer != manualBuzzerOn) {
+    manualBuzzerOn = buzzer;
+    if (!gasAlarmActive()) {
+      melodyStop();
+      buzzerMode = idleBuzzerMode();
+    }
+  }
 
-    // If gas ends at any time, stop everything cleanly
-    if (!gasHigh) {
-      gasSequenceActive = false;
-      gasPlan = PLAN_NONE;
-      gasPlanStage = 0;
-      gasStageUntil = 0;
+  showTempMessage(F("State set"), F(""));
+  return CMD_OK;
+}
 
-      // Let LCD go back to normal sensor display
-      messageUntil = 0;
-      lcdNeedsUpdate = true;
+// One switch on the opcode byte instead of a chain of string compares
+CmdResult dispatchCommand(const Command& cmd) {
+  if (cmd.kind == CMD_WORD) {
+    if (cmdWordIs(cmd, PSTR("BAUD"))) return linkCommand(cmd);
+    if (!cmd.hasArg && runWordCommand(cmd)) return CMD_OK;
+    return CMD_ERR_UNKNOWN;
+  }
+  if (cmd.kind == CMD_TEXT) {
+    showLcdText(cmd);
+    return CMD_OK;
+  }
+  if (cmd.kind == CMD_DATA) {
+    if (cmd.op == 'S') return applyStateFrame(cmd);
 
-      buzzerMode = manualBuzzerOn ? BUZZ_SIREN : BUZZ_OFF;
+    // Rule upload bytes: R=<hex>. Errors are reported by R:<crc> at the end.
+    if (cmd.op != 'R') return CMD_ERR_UNKNOWN;
+    for (uint8_t i = 0; i < cmd.textLen / 2; i++) {
+      if (!rulesLoadByte(cmdDataByte(cmd, i))) break;
+    }
+    return CMD_OK;
+  }
+  if (cmd.kind == CMD_BATCH) return dispatchBatch(cmd);
+  if (cmd.kind == CMD_EMPTY) return CMD_OK;   // "#<seq>" alone: ping
+  if (cmd.kind == CMD_TOO_LONG) return CMD_ERR_TOO_LONG;
+  if (cmd.kind != CMD_SHORT) return CMD_ERR_PARSE;
+
+  CmdResult result = checkShortCommand(cmd);
+  if (result != CMD_OK) return result;
+
+  switch (cmd.op) {
+    // Fan INA (pin 7): X (toggle), X:1 (on), X:0 (off)
+    case 'X':
+      applySwitchArg(cmd, fan_ina_on);
+      showTempMessage(F("Fan INA"), onOffText(fan_ina_on));
+      break;
+
+    // Fan INB (pin 6): Y (toggle), Y:1 (on), Y:0 (off)
+    case 'Y':
+      applySwitchArg(cmd, fan_inb_on);
+      showTempMessage(F("Fan INB"), onOffText(fan_inb_on));
+      break;
+
+    // Whole fan: F (toggle), F:1 (forward, like the gas ventilation), F:0 (both inputs off)
+    case 'F': {
+      bool on = fan_ina_on || fan_inb_on;
+      applySwitchArg(cmd, on);
+      fan_ina_on = on;
+      fan_inb_on = false;
+      showTempMessage(F("Fan"), onOffText(on));
+      break;
     }
-    else {
-      // Gas still high -> proceed through stages
-
-      // ---------- Stage 0: initial 3 seconds SOLID gas alert (NO extra actions) ----------
-      if (gasPlanStage == 0) {
-
-        // Keep SOLID buzzer and GAS ALERT display during these 3 seconds
-        buzzerMode = BUZZ_SOLID;
-
-        // Once 3 seconds pass, NOW we evaluate your IF rules
-        if (millis() >= gasStageUntil) {
-
-          // Decide plan based on CURRENT states AFTER the first 3 seconds
-          bool fanOn = (fan_ina_on || fan_inb_on);
-          bool houseOpen = (doorOpen || windowOpen);
-          if (houseOpen && fanOn) {
-            // 1) open + fan on -> no extra event, go straight to steady alert
-            gasPlan = PLAN_ONLY_ALERT;
-            gasPlanStage = 3;
-            gasStageUntil = millis(); // run immediately
-          }
-          else if (houseOpen && !fanOn) {
-            // 2) open + fan off -> ventilator step only
-            gasPlan = PLAN_VENT_ONLY;
-            gasPlanStage = 2;          // stage 2 = ventilator step
-            gasStageUntil = millis();  // run immediately
-          }
-          else if (!houseOpen && !fanOn) {
-            // 3) closed + fan off -> open then ventilator
-            gasPlan = PLAN_OPEN_THEN_VENT;
-            gasPlanStage = 1;          // stage 1 = opening step
-            gasStageUntil = millis();  // run immediately
-          }
-          else { // (!houseOpen && fanOn)
-            // 4) closed + fan on -> opening step only
-            gasPlan = PLAN_OPEN_ONLY;
-            gasPlanStage = 1;          // stage 1 = opening step
-            gasStageUntil = millis();  // run immediately
-          }
-        }
+
+    // Door command: D (toggle), D:1 (open), D:0 (close)
+    case 'D':
+      applySwitchArg(cmd, doorOpen);
+      showTempMessage(F("Door"), openCloseText(doorOpen));
+      break;
+
+    // Window command: N (toggle), N:1 (open), N:0 (close)
+    case 'N':
+      applySwitchArg(cmd, windowOpen);
+      showTempMessage(F("Window"), openCloseText(windowOpen));
+      break;
+
+    // Buzzer command: B (toggle), B:1 (on), B:0 (off)
+    case 'B':
+      applySwitchArg(cmd, manualBuzzerOn);
+      showTempMessage(F("Buzzer"), onOffText(manualBuzzerOn));
+      if (!gasAlarmActive()) {
+        melodyStop(); // the user asked for the buzzer, that wins over a melody
+        buzzerMode = idleBuzzerMode();
       }
+      break;
+
+    // White light: W (toggle), W:1 (on), W:0 (off)
+    case 'W':
+      applySwitchArg(cmd, whiteLightOn);
+      showTempMessage(F("White Light"), onOffText(whiteLightOn));
+      break;
+
+    // Orange light: O (toggle), O:1 (on), O:0 (off)
+    case 'O':
+      applySwitchArg(cmd, orangeLightOn);
+      showTempMessage(F("Orange Light"), onOffText(orangeLightOn));
+      break;
+
+    // Telemetry format handshake: T:1 = binary frames, T:0 = ASCII STATE lines.
+    // Answered in ASCII before switching so the gateway knows from which point on to expect frames.
+    case 'T':
+      binaryTelemetry = (cmd.arg == 1);
+      serialOut.beginMessage(OUT_URGENT);
+      serialOut.println(binaryTelemetry ? F("TLM binary") : F("TLM ascii"));
+      serialOut.endMessage();
+      return CMD_OK;
+
+    // What comes back after a reset: J:1 = everything, J:0 = lights only, the rest starts safe.
+    // Kept in the journal itself, so it survives the reset it is meant for.
+    case 'J':
+      restoreAll = (cmd.arg == 1);
+      serialOut.beginMessage(OUT_URGENT);
+      serialOut.println(restoreAll ? F("JNL restore all") : F("JNL restore lights"));
+      serialOut.endMessage();
+      return CMD_OK;
+
+    // End of a rule upload: R:<crc8 of the program>
+    case 'R':
+      serialOut.beginMessage(OUT_URGENT);
+      rulesLoadFinish((uint8_t)cmd.arg, serialOut);
+      serialOut.endMessage();
+      return CMD_OK;
+
+    default:
+      return CMD_ERR_UNKNOWN;
+  }
+  return CMD_OK;
+}
 
-      // ---------- Stage 1: OPENING HOUSE step (beep-beep for 3 seconds) ----------
-      if (gasPlanStage == 1 && millis() >= gasStageUntil) {
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: serial ingest (every pass of loop)
+void taskSerialIngest() {
+  PERF_SCOPE(PERF_SERIAL_IN);
+  //bluetooth instructions
+  while (halSerialAvailable() > 0 && pendingAckCount < ACK_QUEUE_SIZE) {
+    if (lineFeed(serialLine, (char)halSerialRead())) {
+      unsigned long rxUs = halMicros();
+      if (firstCommandMs == 0) firstCommandMs = halMillis();
+      Command cmd = parseCommand(serialLine);
+      if (repeatedCommand(cmd)) continue;
+      commandDone(cmd, dispatchCommand(cmd), rxUs);
+    }
+  }
+}
 
-        // Switch to alarm clock beep-beep ONLY for the safety action message
-        buzzerMode = BUZZ_SIREN;
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// Buttons and PIR (called by inputsPoll() for every debounced event, see input_events.h)
+void onInputEvent(InputId input, InputEvent ev, unsigned long timeUs) {
+  unsigned long lagUs = halMicros() - timeUs;
+  if (lagUs > inputLagMaxUs) inputLagMaxUs = lagUs;
+  inputEvents++;
 
-        if (!doorOpen || !windowOpen) {
-          doorOpen = true;
-          windowOpen = true;
-          doorServo.write(150);
-          windowServo.write(150);
-        }
+  // A long press only gets counted: both buttons act on press, like they always did
+  if (ev == INPUT_LONG) inputLongPresses++;
 
-        showTempMessage("Opening house", "for safety");
-        forceShowTempMessageNow();
+  // --- 3. BUTTON 1: FAN TEST ---
+  if (input == INPUT_BTN1 && ev == INPUT_PRESS) {
+    fan_ina_on = !fan_ina_on;
+    showTempMessage(F("Fan INA"), onOffText(fan_ina_on));
+  }
 
-        // Hold this message + beep-beep for 3 seconds
-        gasStageUntil = millis() + 3000;
+  // --- 4. BUTTON 2: SERVO TEST (TOGGLE HOUSE) ---
+  if (input == INPUT_BTN2 && ev == INPUT_PRESS) {
+    bool houseOpen = (doorOpen || windowOpen);
+    houseOpen = !houseOpen;
+    doorOpen = houseOpen;
+    windowOpen = houseOpen;
 
-        // Next stage depends on plan:
-        // - OPEN_THEN_VENT -> go ventilator step
-        // - OPEN_ONLY      -> go steady alert
-        if (gasPlan == PLAN_OPEN_THEN_VENT) gasPlanStage = 2;
-        else                               gasPlanStage = 3;
-      }
+    showTempMessage(F("Door/Window"), openCloseText(houseOpen));
+  }
+}
 
-      // ---------- Stage 2: VENTILATOR ON step (beep-beep for 3 seconds) ----------
-      if (gasPlanStage == 2 && millis() >= gasStageUntil) {
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: input events (every pass, edges were already captured by interrupts)
+void taskInputs() {
+  PERF_SCOPE(PERF_INPUTS);
+  inputsPoll(onInputEvent);
 
-        // Switch to alarm clock beep-beep ONLY for the safety action message
-        buzzerMode = BUZZ_SIREN;
+  // --- 5. MOTION TEST ---
+  // Auto-turn on orange light on motion (unless controlled by Firebase)
+  motionValue = inputLevel(INPUT_PIR);
+  if (motionValue == HIGH) {
+    if (!orangeLightOn) {
+      orangeLightOn = true;
+    }
+  }
+}
 
-        fan_ina_on = true;
-        fan_inb_on = false;  // Set to motor forward direction
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// ========================= GAS / RAIN TABLES =========================
+// Guards and actions of the two state machines (see GAS ALERT LOGIC and state_machine.h)
 
-        showTempMessage("Ventilator ON", "for safety");
-        forceShowTempMessageNow();
+bool gasHigh() {
+  return gasValue > gasThreshold;
+}
 
-        // Hold this message + beep-beep for 3 seconds
-        gasStageUntil = millis() + 3000;
+bool houseOpen() {
+  return doorOpen || windowOpen;
+}
 
-        // After ventilator message, go steady alert
-        gasPlanStage = 3;
-      }
+bool fanOn() {
+  return fan_ina_on || fan_inb_on;
+}
 
-      // ---------- Stage 3: steady GAS ALERT (SOLID buzzer while gas remains high) ----------
-      if (gasPlanStage == 3 && millis() >= gasStageUntil) {
+// --- gas guards ---
+bool gasRises(const Fsm&) { return gasHigh() && !gasWasHigh; }
+bool gasGone(const Fsm&) { return !gasHigh(); }
 
-        // Return to SOLID gas alert sound (requested)
-        buzzerMode = BUZZ_SOLID;
+// The plan is decided AFTER the first 3 seconds, on the states at that moment
+bool planOnlyAlert(const Fsm& f)    { return fsmTimeUp(f) && houseOpen() && fanOn(); }
+bool planVentOnly(const Fsm& f)     { return fsmTimeUp(f) && houseOpen() && !fanOn(); }
+bool planOpenThenVent(const Fsm& f) { return fsmTimeUp(f) && !houseOpen() && !fanOn(); }
+bool planOpenOnly(const Fsm& f)     { return fsmTimeUp(f) && !houseOpen() && fanOn(); }
 
-        // Keep GAS ALERT on the LCD continuously while gas is present
-        tempLine1 = "!! GAS ALERT !!";
-        tempLine2 = "";
-        messageUntil = millis() + 99999999UL;
-        lcdNeedsUpdate = true;
-        forceShowTempMessageNow();
+// --- gas actions ---
+void gasShowAlert() {
+  showTempMessage(F("!! GAS ALERT !!"), F(""), MSG_SAFETY);
+}
 
-        // Push the timer forward so we don't spam forceShowTempMessageNow() every loop
-        gasStageUntil = millis() + 1000;
-      }
-    }
-  } else {
-    // No gas alarm active -> keep manual buzzer state
-    buzzerMode = manualBuzzerOn ? BUZZ_SIREN : BUZZ_OFF;
-  }
+void gasOpenHouse() {
+  // The outputs task moves the servos on this same pass
+  doorOpen = true;
+  windowOpen = true;
+  showTempMessage(F("Opening house"), F("for safety"), MSG_SAFETY);
+}
 
-  // Apply buzzer output (gas alarm owns the buzzer when active)
-  applyBuzzerMode();
+void gasVentOn() {
+  fan_ina_on = true;
+  fan_inb_on = false;  // Set to motor forward direction
+  showTempMessage(F("Ventilator ON"), F("for safety"), MSG_SAFETY);
+}
 
-  // Track last gas state for edge detection
-  gasWasHigh = gasHigh;
-  
-  ////////////////////////////////END GAS PART/////////////////////////////////////////////////////////////
+void gasSteadyAlert() {
+  // Keep GAS ALERT on the LCD continuously while gas is present
+  showTempMessage(F("!! GAS ALERT !!"), F(""), MSG_SAFETY, 99999999UL);
+}
 
-  // --- LCD DISPLAY SYSTEM (Single Write Per Loop) ---
-  if (lcdNeedsUpdate) {
+void gasStop() {
+  // Let LCD go back to normal sensor display
+  messageUntil = 0;
+  tempPriority = MSG_INFO;
+  requestLcdRedraw();
+}
 
-    lcdNeedsUpdate = false;  // Prevent multiple writes this loop
+constexpr FsmRow gasRows[] PROGMEM = {
+  // state             guard             action          ms    next
+  { GAS_IDLE,           gasRises,         gasShowAlert,   3000, GAS_ALERT },
 
-    // Check if we should show a temporary message
-    if (millis() < messageUntil) {
+  { GAS_ALERT,          gasGone,          gasStop,        0,    GAS_IDLE },
+  { GAS_ALERT,          planOnlyAlert,    gasSteadyAlert, 1000, GAS_STEADY },
+  { GAS_ALERT,          planVentOnly,     gasVentOn,      3000, GAS_VENTING },
+  { GAS_ALERT,          planOpenThenVent, gasOpenHouse,   3000, GAS_OPEN_THEN_VENT },
+  { GAS_ALERT,          planOpenOnly,     gasOpenHouse,   3000, GAS_OPENING },
 
-      // Display temporary message
-      lcd.setCursor(0, 0);
-      lcd.print("                ");  // Clear line
-      lcd.setCursor(0, 0);
-      lcd.print(tempLine1);
+  { GAS_OPEN_THEN_VENT, gasGone,          gasStop,        0,    GAS_IDLE },
+  { GAS_OPEN_THEN_VENT, fsmTimeUp,        gasVentOn,      3000, GAS_VENTING },
 
-      lcd.setCursor(0, 1);
-      lcd.print("                ");  // Clear line
-      lcd.setCursor(0, 1);
-      lcd.print(tempLine2);
+  { GAS_OPENING,        gasGone,          gasStop,        0,    GAS_IDLE },
+  { GAS_OPENING,        fsmTimeUp,        gasSteadyAlert, 1000, GAS_STEADY },
 
-    } else {
+  { GAS_VENTING,        gasGone,          gasStop,        0,    GAS_IDLE },
+  { GAS_VENTING,        fsmTimeUp,        gasSteadyAlert, 1000, GAS_STEADY },
 
-      // Display normal sensor values
-      lcd.setCursor(0, 0);
-      lcd.print("                ");
-      lcd.setCursor(0, 0);
-      lcd.print("G:"); lcd.print(gas);
-      lcd.print(" L:"); lcd.print(light);
-
-      lcd.setCursor(0, 1);
-      lcd.print("                ");
-      lcd.setCursor(0, 1);
-      lcd.print("Stm:"); lcd.print(steam);
-      lcd.print(" Sl:"); lcd.print(soil);
-    }
-  }
+  // Push the timer forward so we don't re-queue the message every tick
+  { GAS_STEADY,         gasGone,          gasStop,        0,    GAS_IDLE },
+  { GAS_STEADY,         fsmTimeUp,        gasSteadyAlert, 1000, GAS_STEADY },
+};
 
-  // --- 1. STEAM SENSOR TEST ---
-  if (steam > 100) { 
-    // Auto-turn on white light on rain (unless controlled by Firebase)
-    if (!whiteLightOn) {
-      whiteLightOn = true;
-    }
+constexpr uint8_t gasFirstRow[GAS_STATE_COUNT + 1] PROGMEM = { 0, 1, 6, 8, 10, 12, 14 };
 
-    if (!songPlayed) {
+const char gasStateNames[GAS_STATE_COUNT][10] PROGMEM = {
+  "idle", "alert", "open_vent", "open", "vent", "steady"
+};
+const char gasFsmName[] PROGMEM = "gas";
 
-      showTempMessage("Rain alert!", "");
-      forceShowTempMessageNow(); //shows the message immediately and ignores delays
+const FsmDef gasFsmDef PROGMEM = {
+  gasFsmName, gasStateNames[0], sizeof(gasStateNames[0]), gasRows, gasFirstRow, GAS_STATE_COUNT
+};
 
-      // IMPORTANT: do not fight the gas alarm buzzer
-      if (!gasHigh && !gasSequenceActive) {
-        // Simple melody
-        tone(3, 262, 200); delay(250); // C
-        tone(3, 294, 200); delay(250); // D
-        tone(3, 330, 200); delay(250); // E
-        tone(3, 349, 200); delay(250); // F
-        noTone(3);
-      }
+// Buzzer per gas state: SOLID while alerting, beep-beep during a safety action
+const uint8_t GAS_BUZZ_IDLE = 0xFF;   // not the alarm's: melody / manual buzzer
+constexpr uint8_t gasBuzzer[GAS_STATE_COUNT] PROGMEM = {
+  GAS_BUZZ_IDLE, BUZZ_SOLID, BUZZ_SIREN, BUZZ_SIREN, BUZZ_SIREN, BUZZ_SOLID
+};
 
-      songPlayed = true;
+// --- rain guards / actions ---
+bool steamHigh() {
+  return steamValue > 100;
+}
 
-      // New feature:
-      // When Rain alert! Is turned on, after the event is made, we will trigger a new event:
-      // if the door and window are open we will close them and display a message 'Closing door/window for safety'.
-      if (doorOpen || windowOpen) {
-        doorOpen = false;
-        windowOpen = false;
+bool rainStartsHouseOpen(const Fsm&) { return steamHigh() && houseOpen(); }
+bool rainStarts(const Fsm&) { return steamHigh(); }
+bool rainGone(const Fsm&) { return !steamHigh(); }
+bool whiteLightOff(const Fsm&) { return !whiteLightOn; }
 
-        showTempMessage("Closing house", 
-                        "for safety");
-        forceShowTempMessageNow();
+void rainWhiteLightOn() {
+  // Auto-turn on white light on rain (unless controlled by Firebase)
+  whiteLightOn = true;
+}
 
-        // Servos restored to original settings (both move together immediately, no delay)
-        doorServo.write(0);
-        windowServo.write(0);
-      }
-    }
+void rainAlert() {
+  rainWhiteLightOn();
+  showTempMessage(F("Rain alert!"), F(""), MSG_ALERT);
 
-  } else {
-    songPlayed = false;
+  // IMPORTANT: do not fight the gas alarm buzzer
+  if (!gasHigh() && !gasAlarmActive()) {
+    // Simple melody (plays in the background, the loop keeps running)
+    playMelody(rainMelody, sizeof(rainMelody) / sizeof(rainMelody[0]));
   }
+}
 
-  // --- 3. BUTTON 1: FAN TEST ---
-  if (btn1 == LOW && lastBtn1State == HIGH) {
-    fan_ina_on = !fan_ina_on;
-    showTempMessage("Fan INA", fan_ina_on ? "ON" : "OFF");
-  }
+// When Rain alert! Is turned on, after the event is made, we will trigger a new event:
+// if the door and window are open we will close them and display a message 'Closing door/window for safety'.
+void rainCloseHouse() {
+  rainAlert();
+  doorOpen = false;
+  windowOpen = false;
+  showTempMessage(F("Closing house"), F("for safety"), MSG_ALERT);
+}
 
-  lastBtn1State = btn1;
+constexpr FsmRow rainRows[] PROGMEM = {
+  // state   guard                action            ms  next
+  { RAIN_DRY, rainStartsHouseOpen, rainCloseHouse,   0,  RAIN_WET },
+  { RAIN_DRY, rainStarts,          rainAlert,        0,  RAIN_WET },
+
+  { RAIN_WET, rainGone,            nullptr,          0,  RAIN_DRY },
+  { RAIN_WET, whiteLightOff,       rainWhiteLightOn, 0,  RAIN_WET },
+};
+
+constexpr uint8_t rainFirstRow[RAIN_STATE_COUNT + 1] PROGMEM = { 0, 2, 4 };
+
+const char rainStateNames[RAIN_STATE_COUNT][4] PROGMEM = { "dry", "wet" };
+const char rainFsmName[] PROGMEM = "rain";
+
+const FsmDef rainFsmDef PROGMEM = {
+  rainFsmName, rainStateNames[0], sizeof(rainStateNames[0]), rainRows, rainFirstRow, RAIN_STATE_COUNT
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: sensor sampling + local automations (every 20 ms)
+void taskSensors() {
+  PERF_SCOPE(PERF_SENSORS);
+  // Read all sensors (analog values come from the background ADC, nothing to wait for)
+  adcUpdate();
+  gasValue = adcValue(0);
+  lightValue = adcValue(1);
+  soilValue = adcValue(2);
+  steamValue = adcValue(3);
+
+  // --- 1. STEAM SENSOR TEST --- (rain alert table above)
+  fsmStep(rainFsm, halMillis());
+}
 
-  // Apply fan pin states
-  if (fan_ina_on) {
-    digitalWrite(7, HIGH);
-  } else {
-    digitalWrite(7, LOW);
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: gas alert state machine (every 10 ms)
+void taskGasFsm() {
+  PERF_SCOPE(PERF_GAS);
+  // --- 2. GAS ALARM TEST ---
+  fsmStep(gasFsm, halMillis());
+
+  // The buzzer follows the state (the alarm owns it, otherwise melody / manual buzzer)
+  uint8_t mode = pgm_read_byte(&gasBuzzer[gasFsm.state]);
+  buzzerMode = (mode == GAS_BUZZ_IDLE) ? idleBuzzerMode() : (BuzzerMode)mode;
+
+  // Track last gas state for edge detection
+  gasWasHigh = gasHigh();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: automation rules from EEPROM (every 20 ms, see rules.h)
+void taskRules() {
+  PERF_SCOPE(PERF_RULES);
+  rulesRun(halMillis());
+}
+
+// What the rules can see and do
+int16_t rulesSensor(uint8_t id) {
+  switch (id) {
+    case SEN_GAS:    return gasValue;
+    case SEN_LIGHT:  return lightValue;
+    case SEN_SOIL:   return soilValue;
+    case SEN_STEAM:  return steamValue;
+    default:         return motionValue == HIGH ? 1 : 0;
   }
+}
 
-  if (fan_inb_on) {
-    digitalWrite(6, HIGH);
-  } else {
-    digitalWrite(6, LOW);
+bool& ruleActuatorState(uint8_t id) {
+  switch (id) {
+    case ACT_DOOR:    return doorOpen;
+    case ACT_WINDOW:  return windowOpen;
+    case ACT_FAN_INA: return fan_ina_on;
+    case ACT_FAN_INB: return fan_inb_on;
+    case ACT_WHITE:   return whiteLightOn;
+    case ACT_ORANGE:  return orangeLightOn;
+    default:          return manualBuzzerOn;
   }
+}
 
-  // --- 4. BUTTON 2: SERVO TEST (TOGGLE HOUSE) ---
-  if (btn2 == LOW && lastBtn2State == HIGH) {
-    bool houseOpen = (doorOpen || windowOpen);
-    houseOpen = !houseOpen;
-    doorOpen = houseOpen;
-    windowOpen = houseOpen;
+bool rulesActuator(uint8_t id) {
+  return ruleActuatorState(id);
+}
 
-    if (houseOpen) showTempMessage("Door/Window", "OPEN");
-    else            showTempMessage("Door/Window", "CLOSE");
-  }
+void rulesSetActuator(uint8_t id, bool on) {
+  // The gas alarm owns the house, the fans and the buzzer while it runs
+  bool safetyOutput = (id != ACT_WHITE && id != ACT_ORANGE);
+  if (safetyOutput && gasAlarmActive()) return;
 
-  lastBtn2State = btn2;
+  ruleActuatorState(id) = on;
+  if (id == ACT_BUZZER) buzzerMode = idleBuzzerMode();
+}
 
-  // Apply door servo
-  if (doorOpen) {
-    doorServo.write(150);
-  } else {
-    doorServo.write(0);
-  }
+void rulesShowText(const char* text, uint8_t len) {
+  showSplitText(text, len);
+}
 
-  // Apply window servo
-  if (windowOpen) {
-    windowServo.write(150);
-  } else {
-    windowServo.write(0);
-  }
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: apply outputs (every pass of loop, right after serial so commands act immediately)
+void taskOutputs() {
+  // Apply buzzer output (gas alarm owns the buzzer when active)
+  applyBuzzerMode();
 
-  // --- 5. MOTION TEST ---
-  // Auto-turn on orange light on motion (unless controlled by Firebase)
-  if (motion == HIGH) {
-    if (!orangeLightOn) {
-      orangeLightOn = true;
-    }
-  }
+  PERF_SCOPE(PERF_PINS);
 
-  // Apply light states
-  if (whiteLightOn) {
-    digitalWrite(13, HIGH);
-  } else {
-    digitalWrite(13, LOW);
+  // Apply fan pin states (into the shadow registers, see pins.h)
+  pinSet(PIN_FAN_INA, fan_ina_on);
+  pinSet(PIN_FAN_INB, fan_inb_on);
+
+  // Door and window servos follow their motion profile (only written when the angle changes),
+  // each one once the boot task has attached it
+  unsigned long now = halMillis();
+  if (bootStep != BOOT_DOOR) {
+    servoMoveTo(doorServo, doorOpen ? servoOpenAngle : servoClosedAngle, now);
+    servoUpdate(doorServo, now);
   }
+  if (bootStep != BOOT_DOOR && bootStep != BOOT_WINDOW) {
+    servoMoveTo(windowServo, windowOpen ? servoOpenAngle : servoClosedAngle, now);
+    servoUpdate(windowServo, now);
+  }
+
+  // Apply light states (the white LED also lights up for the LED test while booting)
+  pinSet(PIN_WHITE_LED, whiteLightOn || bootLedTest);
+  pinSet(PIN_ORANGE_LED, orangeLightOn);
+
+  // One write per port, and only for a port where something changed
+  pinsCommit();
+
+  // Commands of this pass are on the pins now
+  sendPendingAcks();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// LCD screen composition
+// Only draws into the LCD frame; the lcdflush task sends whatever actually changed.
+void updateLcdFrame() {
+  PERF_SCOPE(PERF_LCD);
+  // --- LCD DISPLAY SYSTEM ---
+  commitPendingMessage();
+
+  // Check if we should show a temporary message
+  if (halMillis() < messageUntil) {
+
+    // Display temporary message
+    drawTempMessage();
 
-  if (orangeLightOn) {
-    digitalWrite(5, HIGH);
   } else {
-    digitalWrite(5, LOW);
+
+    // Display normal sensor values
+    lcdFrame.clear();
+    lcdFrame.setCursor(0, 0);
+    lcdFrame.print(F("G:")); lcdFrame.print(gasValue);
+    lcdFrame.print(F(" L:")); lcdFrame.print(lightValue);
+
+    lcdFrame.setCursor(0, 1);
+    lcdFrame.print(F("Stm:")); lcdFrame.print(steamValue);
+    lcdFrame.print(F(" Sl:")); lcdFrame.print(soilValue);
   }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: LCD refresh (every 500 ms, or sooner when requestLcdRedraw() kicks it)
+void taskLcd() {
+  updateLcdFrame();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: LCD flush (every pass, at most lcdFlushBudgetUs of I2C per pass)
+void taskLcdFlush() {
+  PERF_SCOPE(PERF_LCD_FLUSH);
+  lcdFrame.flushChanges(lcdFlushBudgetUs);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: telemetry push (every pass, but only sends when something changed or a keyframe is due)
+void taskStatePush() {
+  unsigned long now = halMillis();
+  uint8_t bits = currentStateBits(motionValue);
+
+  bool actuatorChanged = !stateEverSent || bits != sentStateBits;
+  bool sensorMoved = abs(gasValue - sentGas) > gasDeadband ||
+                     abs(steamValue - sentSteam) > steamDeadband;
+  bool sensorDue = sensorMoved && (now - lastStatePush >= stateSensorMinInterval);
+  bool keyframeDue = (now - lastStatePush >= stateKeyframeInterval);
+
+  if (!actuatorChanged && !sensorDue && !keyframeDue) return;
 
   // Send current physical state and sensor values for Firebase bidirectional sync
-  sendStateLine(gas, steam, motion);
+  // (queued; the txq task renders and sends it when the UART has room)
+  serialOut.postState();
+
+  sentStateBits = bits;
+  sentGas = gasValue;
+  sentSteam = steamValue;
+  stateEverSent = true;
+  lastStatePush = now;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: EEPROM writes, the state journal first, then a rule program save
+// (every pass, writes at most one EEPROM byte and never waits)
+void taskJournal() {
+  journalPoll(currentStateBits(LOW) | (restoreAll ? JOURNAL_RESTORE_ALL : 0));
+  rulesPoll();   // saving an uploaded rule program shares the EEPROM, same one-byte-at-a-time way
+}
 
-  delay(200); 
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: outbound serial queue (every pass, never waits for the UART)
+void taskSerialOut() {
+  PERF_SCOPE(PERF_TXQ);
+  serialOut.pump();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// TASK: serial link speed (every pass, see SERIAL LINK SPEED). Only switches once the TX
+// buffer is empty, so halSerialBegin() never has to wait for more than the last byte.
+void taskLink() {
+  if (linkState == LINK_DRAINING) {
+    // "BAUD switch" and the ACK have to leave on the old rate
+    if (serialOut.wantsToSend() || !halSerialTxEmpty()) return;
+    linkSetBaud(linkNewBaud);
+    linkSwitchMs = halMillis();
+    linkState = LINK_PROBING;
+  }
+  else if (linkState == LINK_PROBING && halMillis() - linkSwitchMs >= LINK_PROBE_MS) {
+    if (!halSerialTxEmpty()) return;
+    linkSetBaud(LINK_BOOT_BAUD);
+    linkState = LINK_STEADY;
+    linkAnswer(F("fallback "), LINK_BOOT_BAUD);
+  }
 }
@@ -0,0 +1,50 @@
+#include "melody.h"
+
+static const MelodyNote* melodyNotes = nullptr;
+static uint8_t melodyCount = 0;
+static uint8_t melodyIndex = 0;
+static uint8_t melodyPin = 0;
+static bool melodyPlaying = false;
+static unsigned long melodyNextStep = 0;
+
+static void playNote(uint8_t i) {
+  MelodyNote n;
+  memcpy_P(&n, &melodyNotes[i], sizeof(n));
+
+  if (n.freq > 0) halTone(melodyPin, n.freq, n.toneMs);
+  else            halNoTone(melodyPin);
+
+  melodyNextStep = halMillis() + n.stepMs;
+}
+
+void melodyStart(uint8_t pin, const MelodyNote* notes, uint8_t count) {
+  melodyNotes = notes;
+  melodyCount = count;
+  melodyPin = pin;
+  melodyIndex = 0;
+  melodyPlaying = (count > 0);
+
+  if (melodyPlaying) playNote(0);
+}
+
+void melodyUpdate() {
+  if (!melodyPlaying) return;
+  if ((long)(halMillis() - melodyNextStep) < 0) return;
+
+  melodyIndex++;
+  if (melodyIndex >= melodyCount) {
+    melodyStop();
+    return;
+  }
+  playNote(melodyIndex);
+}
+
+void melodyStop() {
+  if (!melodyPlaying) return;
+  melodyPlaying = false;
+  halNoTone(melodyPin);
+}
+
+bool melodyActive() {
+  return melodyPlaying;
+}
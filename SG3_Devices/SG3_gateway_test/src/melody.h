@@ -0,0 +1,29 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= NON-BLOCKING MELODY ENGINE =================
+// Melodies are tables of notes stored in flash (PROGMEM). Instead of tone() + delay(),
+// melodyUpdate() is called every pass of loop() and moves on to the next note once the
+// current one's step time has passed, so nothing else has to wait for a song to finish.
+// The engine does not decide WHEN it may use the buzzer: main.cpp does that through
+// buzzerMode / applyBuzzerMode(), which calls melodyStop() as soon as something
+// more important (the gas alarm) takes the buzzer.
+
+struct MelodyNote {
+  uint16_t freq;     // Hz (0 = rest)
+  uint16_t toneMs;   // how long the note sounds
+  uint16_t stepMs;   // time until the next note starts (>= toneMs leaves a small gap)
+};
+
+// Starts playing a PROGMEM note table from its first note on the given pin.
+void melodyStart(uint8_t pin, const MelodyNote* notes, uint8_t count);
+
+// Advances to the next note when it is due. Cheap when nothing is playing.
+void melodyUpdate();
+
+// Silences the buzzer and forgets the current melody (no-op when idle).
+void melodyStop();
+
+bool melodyActive();
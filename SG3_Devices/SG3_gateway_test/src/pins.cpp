@@ -0,0 +1,33 @@
+#include "pins.h"
+
+uint8_t pinShadow[HAL_PORT_COUNT];
+
+static const uint8_t portMask[HAL_PORT_COUNT] = { shadowMask(HAL_PORT_B), shadowMask(HAL_PORT_D) };
+
+// What the port register holds right now (shadow bits only)
+static uint8_t pinWritten[HAL_PORT_COUNT];
+
+void pinsBegin() {
+  for (uint8_t i = 0; i < SHADOW_PIN_COUNT; i++) halPinMode(shadowPins[i].pin, OUTPUT);
+  halPinMode(PIN_BUZZER.pin, OUTPUT);
+
+  halPinMode(PIN_BTN1.pin, INPUT);
+  halPinMode(PIN_BTN2.pin, INPUT);
+  halPinMode(PIN_PIR.pin, INPUT);
+
+  // Force everything OFF immediately at boot
+  for (uint8_t port = 0; port < HAL_PORT_COUNT; port++) {
+    pinShadow[port] = 0;
+    pinWritten[port] = 0;
+    halPortWrite(port, portMask[port], 0);
+  }
+  halDigitalWrite(PIN_BUZZER.pin, LOW);
+}
+
+void pinsCommit() {
+  for (uint8_t port = 0; port < HAL_PORT_COUNT; port++) {
+    if (pinShadow[port] == pinWritten[port]) continue;
+    halPortWrite(port, portMask[port], pinShadow[port]);
+    pinWritten[port] = pinShadow[port];
+  }
+}
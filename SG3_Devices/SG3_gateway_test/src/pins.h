@@ -0,0 +1,64 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= PIN MAP =================
+// Every pin of the house in one table. On the Uno the port and bit of a pin are fixed
+// (pins 0..7 = port D, 8..13 = port B), so unoPin() works them out at compile time.
+//
+// The plain outputs (LEDs, fan, relay) no longer go through digitalWrite() on every pass,
+// which looked the port up, locked out interrupts and wrote the register every time, mostly
+// with the value it already had. pinSet() only changes a bit in a shadow copy of the port,
+// and pinsCommit() writes each port once at the end of the outputs task, and only if one of
+// its bits changed. pinRead() reads the PIN register directly.
+
+struct PinDef {
+  uint8_t pin;    // Arduino pin number (for the HAL calls that still want one)
+  uint8_t port;   // HalPort
+  uint8_t mask;   // bit of the pin in that port
+};
+
+constexpr PinDef unoPin(uint8_t pin) {
+  return PinDef{ pin, (uint8_t)(pin < 8 ? HAL_PORT_D : HAL_PORT_B), (uint8_t)(1 << (pin & 7)) };
+}
+
+constexpr PinDef PIN_PIR          = unoPin(2);    // PIR motion sensor (INT0)
+constexpr PinDef PIN_BUZZER       = unoPin(3);    // tone() owns it, not in the shadow
+constexpr PinDef PIN_BTN1         = unoPin(4);    // button 1 (fan)
+constexpr PinDef PIN_ORANGE_LED   = unoPin(5);    // yellow / orange LED
+constexpr PinDef PIN_FAN_INB      = unoPin(6);
+constexpr PinDef PIN_FAN_INA      = unoPin(7);
+constexpr PinDef PIN_BTN2         = unoPin(8);    // button 2 (door + window)
+constexpr PinDef PIN_DOOR_SERVO   = unoPin(9);    // the Servo library drives these two
+constexpr PinDef PIN_WINDOW_SERVO = unoPin(10);
+constexpr PinDef PIN_RELAY        = unoPin(12);
+constexpr PinDef PIN_WHITE_LED    = unoPin(13);
+
+// The outputs that live in the shadow registers
+constexpr PinDef shadowPins[] = { PIN_ORANGE_LED, PIN_FAN_INB, PIN_FAN_INA, PIN_RELAY, PIN_WHITE_LED };
+const uint8_t SHADOW_PIN_COUNT = sizeof(shadowPins) / sizeof(shadowPins[0]);
+
+// Bits of a port that belong to the shadow (the other pins of the port are never touched)
+constexpr uint8_t shadowMask(uint8_t port, uint8_t i = 0) {
+  return i == SHADOW_PIN_COUNT ? 0 :
+         (uint8_t)((shadowPins[i].port == port ? shadowPins[i].mask : 0) | shadowMask(port, i + 1));
+}
+
+extern uint8_t pinShadow[HAL_PORT_COUNT];
+
+// Sets the pin modes of the whole table and writes every shadowed output LOW.
+void pinsBegin();
+
+// Changes the output in the shadow only. Nothing reaches the pin before pinsCommit().
+inline void pinSet(const PinDef& p, bool on) {
+  if (on) pinShadow[p.port] |= p.mask;
+  else    pinShadow[p.port] &= (uint8_t)~p.mask;
+}
+
+// Writes every port whose shadow changed since the last commit (one register write each).
+void pinsCommit();
+
+inline uint8_t pinRead(const PinDef& p) {
+  return (halPortRead(p.port) & p.mask) ? HIGH : LOW;
+}
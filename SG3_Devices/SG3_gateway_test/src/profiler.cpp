@@ -0,0 +1,83 @@
+#include "profiler.h"
+
+#if defined(PERF_PROBES)
+
+struct PerfStats {
+  unsigned long count;
+  unsigned long sumUs;
+  uint16_t minUs;
+  uint16_t maxUs;
+  // Shape of the distribution: when a bucket would overflow, all buckets are halved
+  uint16_t hist[PERF_BUCKETS];
+};
+
+static PerfStats perf[PERF_COUNT];
+
+// Names in flash, 8 chars max so a report line fits OUT_REPORT_LINE_MAX
+static const char perfNames[PERF_COUNT][9] PROGMEM = {
+  "loop", "serial", "inputs", "sensors", "gas", "rules", "buzzer", "pins", "lcd", "lcdflush", "state", "txq"
+};
+
+void perfRecord(uint8_t section, unsigned long us) {
+  PerfStats& p = perf[section];
+  uint16_t us16 = us > 65535UL ? 65535 : (uint16_t)us;
+
+  if (p.count == 0 || us16 < p.minUs) p.minUs = us16;
+  if (us16 > p.maxUs) p.maxUs = us16;
+  p.count++;
+  p.sumUs += us;
+
+  // Bucket = number of bits of us, minus 2 (so 0..3 us share bucket 0)
+  uint8_t bits = 0;
+  while (us16 >> bits) bits++;
+  uint8_t b = bits > 2 ? bits - 2 : 0;
+  if (b >= PERF_BUCKETS) b = PERF_BUCKETS - 1;
+
+  if (p.hist[b] == 65535) {
+    for (uint8_t i = 0; i < PERF_BUCKETS; i++) p.hist[i] >>= 1;
+  }
+  p.hist[b]++;
+}
+
+void perfReset() {
+  memset(perf, 0, sizeof(perf));
+}
+
+// Line 0 = bucket legend, then two lines per section: numbers, then the histogram in percent
+bool perfReportLine(Print& out, uint8_t index) {
+  if (index == 0) {
+    out.println(F("PERF% buckets <4,<8,<16,<32,<64,<128,<256,<512,<1k,<2k,2k+ us"));
+    return true;
+  }
+  index--;
+  uint8_t s = index / 2;
+  if (s >= PERF_COUNT) return false;
+
+  const PerfStats& p = perf[s];
+  if (index % 2 == 0) {
+    out.print(F("PERF "));
+    out.print((const __FlashStringHelper*)perfNames[s]);
+    out.print(F(" n="));
+    out.print(p.count);
+    out.print(F(" min="));
+    out.print(p.minUs);
+    out.print(F(" mean="));
+    out.print(p.count ? p.sumUs / p.count : 0UL);
+    out.print(F(" max="));
+    out.println(p.maxUs);
+  } else {
+    unsigned long total = 0;
+    for (uint8_t i = 0; i < PERF_BUCKETS; i++) total += p.hist[i];
+
+    out.print(F("PERF% "));
+    out.print((const __FlashStringHelper*)perfNames[s]);
+    for (uint8_t i = 0; i < PERF_BUCKETS; i++) {
+      out.print(i == 0 ? ' ' : ',');
+      out.print(total ? (unsigned long)p.hist[i] * 100UL / total : 0UL);
+    }
+    out.println();
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= SECTION PROFILER =================
+// Measures how long each section of the loop takes. Put PERF_SCOPE(PERF_xxx); at the top
+// of a block and the time until the end of that block is recorded for that section:
+// count, min, mean, max and a log2 histogram (bucket 0 = under 4 us, then <8, <16, ...
+// up to the last bucket = 2048 us and more). PERF? prints it, PERF! clears it.
+//
+// Only compiled in with -DPERF_PROBES, which only env:native sets. The table is ~400 bytes,
+// and env:uno has nowhere near that left for it (MEM? shows what is left for the stack),
+// so there is no Uno build with the profiler. In env:uno PERF_SCOPE() expands to nothing
+// and the profiler costs no flash, RAM or time.
+//
+// Timing uses halMicros(). On the simulator that is the virtual clock, so the numbers
+// show the time the HAL models (serial waits, EEPROM busy), not CPU time.
+
+enum PerfSection {
+  PERF_LOOP,        // one whole pass of loop()
+  PERF_SERIAL_IN,   // serial ingest + command dispatch
+  PERF_INPUTS,      // button / PIR events
+  PERF_SENSORS,     // ADC filtering + rain logic
+  PERF_GAS,         // gas state machine
+  PERF_RULES,       // automation rules from EEPROM
+  PERF_BUZZER,      // applyBuzzerMode()
+  PERF_PINS,        // servo / pin apply
+  PERF_LCD,         // LCD screen composition
+  PERF_LCD_FLUSH,   // LCD cells over I2C
+  PERF_STATE_LINE,  // rendering the STATE line / frame (inside txq)
+  PERF_TXQ,         // outbound serial queue pump
+  PERF_COUNT
+};
+
+const uint8_t PERF_BUCKETS = 11;
+
+#if defined(PERF_PROBES)
+
+void perfRecord(uint8_t section, unsigned long us);
+
+// Records the time from construction to the end of the enclosing block
+class PerfScope {
+public:
+  explicit PerfScope(uint8_t s) : section(s), start(halMicros()) {}
+  ~PerfScope() { perfRecord(section, halMicros() - start); }
+private:
+  uint8_t section;
+  unsigned long start;
+};
+
+#define PERF_CONCAT2(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT2(a, b)
+#define PERF_SCOPE(section) PerfScope PERF_CONCAT(perfScope_, __LINE__)(section)
+
+// PERF? report, one line per call (ReportLineFn shape, see serial_out.h)
+bool perfReportLine(Print& out, uint8_t index);
+
+// PERF!
+void perfReset();
+
+#else
+
+#define PERF_SCOPE(section) do {} while (0)
+
+#endif
@@ -0,0 +1,349 @@
+#include "rules.h"
+#include "telemetry_frame.h"   // crc8Update
+
+static const uint8_t RULES_MAGIC = 0xA5;
+
+struct RuleState {
+  bool last : 1;             // condition of the previous tick (for RULE_EDGE)
+  bool holding : 1;          // HELD: its input has been true since heldSince
+  unsigned long heldSince;
+};
+
+static RuleState ruleState[RULES_MAX];
+static uint8_t ruleCount = 0;   // 0 = nothing to run
+static uint8_t codeLen = 0;
+static uint8_t codeCrcValue = 0;
+
+// Copy of the program in RAM, which the rules normally run from. It is also where an upload
+// is put together (R= only copies into it, so a line never waits for the EEPROM); the rules
+// run from the EEPROM copy meanwhile.
+static uint8_t code[RULES_CODE_MAX];
+
+// true = the rules run from the EEPROM copy (during an upload, and after one that failed)
+static bool fromEeprom = false;
+
+static bool loading = false;
+static bool loadTooLong = false;
+static uint8_t loadLen = 0;
+
+// Background EEPROM save, one step per rulesPoll() whenever the EEPROM is ready:
+// step 0 = clear the magic, 1..codeLen = code, then length, crc and the magic last
+static uint8_t saveStep = 0;
+static uint8_t saveEnd = 0;
+
+enum RuleError { ERR_NONE, ERR_LEN, ERR_OP, ERR_ARG, ERR_STACK, ERR_THEN, ERR_HELD, ERR_RULES, ERR_CRC, ERR_LOAD };
+
+static const char ruleErrors[][6] PROGMEM = {
+  "", "len", "op", "arg", "stack", "then", "held", "rules", "crc", "load"
+};
+
+static uint8_t codeByte(uint8_t i) {
+  if (fromEeprom) return halEepromRead(RULES_EEPROM_ADDR + 3 + i);
+  return code[i];
+}
+
+static uint8_t codeCrc(uint8_t len) {
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < len; i++) crc = crc8Update(crc, codeByte(i));
+  return crc;
+}
+
+static bool saving() {
+  return saveStep < saveEnd;
+}
+
+// Bytes taken by the op at i (with its operands), 0 = unknown op.
+// For LCD this reads the byte after i, so checkProgram() makes sure that one is in the rule first.
+static uint8_t opSize(uint8_t i) {
+  switch (codeByte(i)) {
+    case OP_K16: case OP_HELD: case OP_SET:
+      return 3;
+    case OP_SEN: case OP_ACT:
+      return 2;
+    case OP_GT: case OP_LT: case OP_EQ: case OP_AND: case OP_OR: case OP_NOT: case OP_THEN:
+      return 1;
+    case OP_LCD:
+      return (uint8_t)(2 + codeByte(i + 1));
+    default:
+      return 0;
+  }
+}
+
+// Walks the whole program once, so rulesRun() never has to check anything
+static RuleError checkProgram(uint8_t len, uint8_t& rules, uint8_t& errAt) {
+  uint8_t pos = 0;
+  rules = 0;
+
+  while (pos < len) {
+    errAt = pos;
+    uint16_t end = pos + 1 + codeByte(pos);
+    if (end <= pos + 2u || end > len) return ERR_LEN;
+    if (rules == RULES_MAX) return ERR_RULES;
+    if (codeByte(pos + 1) & ~RULE_EDGE) return ERR_ARG;
+
+    uint8_t depth = 0;
+    bool thenSeen = false;
+    bool heldSeen = false;
+
+    for (uint8_t i = pos + 2; i < end; ) {
+      errAt = i;
+      uint8_t op = codeByte(i);
+      // The size of LCD is in its first operand, which has to be inside the rule before anyone reads it
+      if (op == OP_LCD && i + 1u >= end) return ERR_LEN;
+      if (op == OP_LCD && codeByte(i + 1) > RULE_LCD_MAX) return ERR_ARG;
+      uint8_t n = opSize(i);
+      if (n == 0) return ERR_OP;
+      if (i + n > end) return ERR_LEN;
+
+      bool action = (op == OP_SET || op == OP_LCD);
+      if (action != thenSeen && op != OP_THEN) return ERR_THEN;
+
+      switch (op) {
+        case OP_K16:
+          depth++;
+          break;
+        case OP_SEN:
+          if (codeByte(i + 1) >= SEN_COUNT) return ERR_ARG;
+          depth++;
+          break;
+        case OP_ACT:
+          if (codeByte(i + 1) >= ACT_COUNT) return ERR_ARG;
+          depth++;
+          break;
+        case OP_GT: case OP_LT: case OP_EQ: case OP_AND: case OP_OR:
+          if (depth < 2) return ERR_STACK;
+          depth--;
+          break;
+        case OP_NOT:
+          if (depth < 1) return ERR_STACK;
+          break;
+        case OP_HELD:
+          if (depth < 1) return ERR_STACK;
+          if (heldSeen) return ERR_HELD;   // one timer per rule
+          heldSeen = true;
+          break;
+        case OP_THEN:
+          if (thenSeen) return ERR_THEN;
+          if (depth != 1) return ERR_STACK;
+          thenSeen = true;
+          depth = 0;
+          break;
+        case OP_SET:
+          if (codeByte(i + 1) >= ACT_COUNT || codeByte(i + 2) > 1) return ERR_ARG;
+          break;
+      }
+      if (depth > RULE_STACK) return ERR_STACK;
+      i += n;
+    }
+
+    errAt = pos;
+    if (!thenSeen) return ERR_THEN;
+    pos = (uint8_t)end;
+    rules++;
+  }
+  return ERR_NONE;
+}
+
+static void resetRuleState() {
+  memset(ruleState, 0, sizeof(ruleState));
+}
+
+void rulesBegin() {
+  ruleCount = 0;
+  codeLen = 0;
+  fromEeprom = false;
+  resetRuleState();
+
+  if (halEepromRead(RULES_EEPROM_ADDR) != RULES_MAGIC) return;
+  uint8_t len = halEepromRead(RULES_EEPROM_ADDR + 1);
+  if (len > RULES_CODE_MAX) return;
+  for (uint8_t i = 0; i < len; i++) code[i] = halEepromRead(RULES_EEPROM_ADDR + 3 + i);
+  codeCrcValue = halEepromRead(RULES_EEPROM_ADDR + 2);
+  if (codeCrc(len) != codeCrcValue) return;
+
+  uint8_t rules, errAt;
+  if (checkProgram(len, rules, errAt) != ERR_NONE) return;
+  ruleCount = rules;
+  codeLen = len;
+}
+
+static int16_t code16(uint8_t i) {
+  return (int16_t)(codeByte(i) | (uint16_t)codeByte(i + 1) << 8);
+}
+
+void rulesRun(unsigned long now) {
+  // Reading the EEPROM copy would wait for a write in progress (the journal); skip this tick instead
+  if (fromEeprom && ruleCount > 0 && !halEepromReady()) return;
+
+  uint8_t pos = 0;
+
+  for (uint8_t r = 0; r < ruleCount; r++) {
+    RuleState& rs = ruleState[r];
+    uint8_t end = (uint8_t)(pos + 1 + codeByte(pos));
+    uint8_t flags = codeByte(pos + 1);
+    uint8_t i = pos + 2;
+
+    // Condition (checked at upload: no underflow, one value left at THEN)
+    int16_t st[RULE_STACK];
+    uint8_t sp = 0;
+    bool atThen = false;
+    while (!atThen) {
+      uint8_t op = codeByte(i);
+      switch (op) {
+        case OP_K16: st[sp++] = code16(i + 1); break;
+        case OP_SEN: st[sp++] = rulesSensor(codeByte(i + 1)); break;
+        case OP_ACT: st[sp++] = rulesActuator(codeByte(i + 1)) ? 1 : 0; break;
+        case OP_GT:  sp--; st[sp - 1] = st[sp - 1] > st[sp]; break;
+        case OP_LT:  sp--; st[sp - 1] = st[sp - 1] < st[sp]; break;
+        case OP_EQ:  sp--; st[sp - 1] = st[sp - 1] == st[sp]; break;
+        case OP_AND: sp--; st[sp - 1] = st[sp - 1] && st[sp]; break;
+        case OP_OR:  sp--; st[sp - 1] = st[sp - 1] || st[sp]; break;
+        case OP_NOT: st[sp - 1] = !st[sp - 1]; break;
+        case OP_HELD:
+          if (!st[sp - 1]) {
+            rs.holding = false;
+          } else if (!rs.holding) {
+            rs.holding = true;
+            rs.heldSince = now;
+          }
+          st[sp - 1] = rs.holding && now - rs.heldSince >= (uint16_t)code16(i + 1);
+          break;
+        case OP_THEN: atThen = true; break;
+      }
+      i += opSize(i);
+    }
+
+    bool cond = st[0] != 0;
+    bool fire = (flags & RULE_EDGE) ? (cond && !rs.last) : cond;
+    rs.last = cond;
+
+    // Actions
+    while (fire && i < end) {
+      if (codeByte(i) == OP_SET) {
+        rulesSetActuator(codeByte(i + 1), codeByte(i + 2) != 0);
+      } else {   // OP_LCD
+        char text[RULE_LCD_MAX];
+        uint8_t len = codeByte(i + 1);
+        for (uint8_t k = 0; k < len; k++) text[k] = (char)codeByte(i + 2 + k);
+        rulesShowText(text, len);
+      }
+      i += opSize(i);
+    }
+
+    pos = end;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Upload. The bytes are collected in code[] and checked there, while the old program keeps
+// running from its EEPROM copy. Only a program that checks out replaces it: the rules switch
+// back to code[] and rulesPoll() writes the EEPROM copy with the header last, so a reset in the
+// middle of the save leaves no program instead of half a one.
+
+bool rulesLoadStart() {
+  // The EEPROM copy only matches code[] once the last save is complete
+  if (saving()) return false;
+
+  fromEeprom = true;
+  loading = true;
+  loadTooLong = false;
+  loadLen = 0;
+  return true;
+}
+
+bool rulesLoadByte(uint8_t b) {
+  if (!loading) return false;
+  if (loadLen >= RULES_CODE_MAX) {
+    loadTooLong = true;
+    return false;
+  }
+  code[loadLen++] = b;
+  return true;
+}
+
+void rulesLoadFinish(uint8_t crc, Print& answer) {
+  uint8_t rules = 0;
+  uint8_t errAt = 0;
+  RuleError err;
+
+  if (!loading) {
+    err = ERR_LOAD;
+  } else if (loadTooLong) {
+    err = ERR_LEN;
+    errAt = loadLen;
+  } else {
+    // Check the upload in code[]; the rules don't run in between, so this is safe
+    fromEeprom = false;
+    if (codeCrc(loadLen) != crc) err = ERR_CRC;
+    else                         err = checkProgram(loadLen, rules, errAt);
+  }
+
+  if (err != ERR_NONE) {
+    if (loading) fromEeprom = true;   // the old program keeps running
+    loading = false;
+    answer.print(F("RULE err "));
+    answer.print((const __FlashStringHelper*)ruleErrors[err]);
+    answer.print(F(" @"));
+    answer.println(errAt);
+    return;
+  }
+
+  // Swap: the rules run from code[] until rulesPoll() has saved it
+  loading = false;
+  resetRuleState();
+  ruleCount = rules;
+  codeLen = loadLen;
+  codeCrcValue = crc;
+  saveStep = 0;
+  saveEnd = (uint8_t)(codeLen + 4);
+
+  answer.print(F("RULE ok n="));
+  answer.print(ruleCount);
+  answer.print(F(" len="));
+  answer.println(codeLen);
+}
+
+void rulesPoll() {
+  // An unchanged byte costs nothing, so keep going until one really has to be written
+  while (saving() && halEepromReady()) {
+    uint8_t step = saveStep++;
+    if (step == 0)                 halEepromUpdate(RULES_EEPROM_ADDR, 0xFF);
+    else if (step <= codeLen)      halEepromUpdate(RULES_EEPROM_ADDR + 3 + step - 1, code[step - 1]);
+    else if (step == codeLen + 1)  halEepromUpdate(RULES_EEPROM_ADDR + 1, codeLen);
+    else if (step == codeLen + 2)  halEepromUpdate(RULES_EEPROM_ADDR + 2, codeCrcValue);
+    else                           halEepromUpdate(RULES_EEPROM_ADDR, RULES_MAGIC);
+  }
+}
+
+// Line 0 = the program, then one line per rule
+bool rulesReportLine(Print& out, uint8_t index) {
+  if (index == 0) {
+    out.print(F("RULES n="));
+    out.print(ruleCount);
+    out.print(F(" len="));
+    out.print(codeLen);
+    out.print(F(" max="));
+    out.print(RULES_CODE_MAX);
+    if (loading) out.print(F(" loading"));
+    if (saving()) out.print(F(" saving"));
+    out.println();
+    return true;
+  }
+
+  uint8_t r = index - 1;
+  if (r >= ruleCount) return false;
+
+  uint8_t pos = 0;
+  for (uint8_t k = 0; k < r; k++) pos = (uint8_t)(pos + 1 + codeByte(pos));
+
+  out.print(F("RULE "));
+  out.print(r);
+  out.print(F(" @"));
+  out.print(pos);
+  out.print(F(" len="));
+  out.print(codeByte(pos));
+  out.print((codeByte(pos + 1) & RULE_EDGE) ? F(" edge") : F(" level"));
+  out.print(F(" cond="));
+  out.println(ruleState[r].last ? 1 : 0);
+  return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= AUTOMATION RULES =================
+// Small automations ("gas above 60 for 2 s -> fan on") that run on the board itself, so they
+// react within one tick instead of going gateway -> Firestore -> gateway. The rules are
+// bytecode uploaded over serial, checked once, kept in EEPROM and run every tick from a copy
+// in RAM (RULES_CODE_MAX bytes). An upload is put together in that copy too, so R= lines can
+// come back to back; the old program keeps running from the EEPROM meanwhile. Only an upload
+// that checks out replaces it (the EEPROM is written in the background afterwards, rulesPoll()),
+// a failed one changes nothing.
+//
+// Upload (one line each, answers are urgent lines):
+//   RULE!        start a new upload                             -> "RULE load"
+//                ("RULE busy" while the last program is still being saved, ~0.5 s at most)
+//   R=<hex>      next bytes of the program (any number of lines)
+//   R:<crc>      end of upload, crc = CRC-8 of all bytes (decimal) -> "RULE ok n=2 len=27"
+//                                                                  or "RULE err <what> @<offset>"
+//   RULE?        report: the program, then one line per rule
+// A program that fails the check is never run. The gateway side is rules_asm.py.
+//
+// Program = rules back to back, each one:
+//   [len] [flags] <condition ops> THEN <action ops>        (len = bytes after the len byte)
+// flags: RULE_EDGE = actions run once when the condition becomes true,
+//        otherwise they run every tick while it is true.
+//
+// Condition ops work on a small stack of 16-bit values:
+//   K16 lo hi    push a number             SEN n   push sensor n (RuleSensor)
+//   ACT n        push actuator n (0/1)     GT LT EQ AND OR NOT
+//   HELD lo hi   pop c, push 1 once c has been true for that many ms without a break
+// Actions:
+//   SET n v      actuator n on (v = 1) or off (v = 0)
+//   LCD len text show "line1|line2" on the LCD (normal message, 3 s)
+//
+// There are no jumps, so a tick costs at most one step per program byte (RULES_CODE_MAX).
+// The gas alarm is not a rule and rules cannot move the door, window or fans or the
+// buzzer while it is running (see rulesSetActuator in main.cpp).
+
+enum RuleOp {
+  OP_K16 = 0x01, OP_SEN, OP_ACT,
+  OP_GT, OP_LT, OP_EQ, OP_AND, OP_OR, OP_NOT,
+  OP_HELD,
+  OP_THEN = 0x10,
+  OP_SET = 0x20, OP_LCD
+};
+
+enum RuleSensor { SEN_GAS, SEN_LIGHT, SEN_SOIL, SEN_STEAM, SEN_MOTION, SEN_COUNT };
+enum RuleActuator { ACT_DOOR, ACT_WINDOW, ACT_FAN_INA, ACT_FAN_INB, ACT_WHITE, ACT_ORANGE, ACT_BUZZER, ACT_COUNT };
+
+const uint8_t RULE_EDGE = 0x01;
+
+const uint8_t RULES_MAX = 8;
+const uint8_t RULE_STACK = 6;
+const uint8_t RULE_LCD_MAX = 33;        // "16 chars|16 chars"
+
+// EEPROM: [0] magic  [1] code length  [2] crc8 of the code  [3..] code
+const uint16_t RULES_EEPROM_ADDR = 0;
+const uint8_t RULES_CODE_MAX = 125;     // the whole area is 128 bytes
+
+// Provided by main.cpp
+int16_t rulesSensor(uint8_t id);
+bool rulesActuator(uint8_t id);
+void rulesSetActuator(uint8_t id, bool on);
+void rulesShowText(const char* text, uint8_t len);
+
+// Loads the program from EEPROM if it is there and valid
+void rulesBegin();
+
+// Runs every rule once
+void rulesRun(unsigned long now);
+
+// Upload steps (RULE!, R=, R:)
+// R: answers as soon as the program checks out and runs it right away; saving it to the EEPROM
+// takes ~3.4 ms per changed byte and is done by rulesPoll().
+bool rulesLoadStart();           // false = busy saving the last upload, try again later
+bool rulesLoadByte(uint8_t b);   // false = no upload running or the program got too long
+void rulesLoadFinish(uint8_t crc, Print& answer);
+
+// Writes the next byte of a program save when the EEPROM is ready. Call often, it never waits.
+void rulesPoll();
+
+// RULE? report
+bool rulesReportLine(Print& out, uint8_t index);
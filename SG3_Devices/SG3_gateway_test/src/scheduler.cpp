@@ -0,0 +1,106 @@
+#include "scheduler.h"
+
+static const Task* schedTasks = nullptr;   // PROGMEM
+static TaskState* schedState = nullptr;
+static uint8_t schedCount = 0;
+
+// halMillis() wraps after ~49 days, so compare with a signed difference instead of ">="
+static bool isDue(unsigned long now, unsigned long at) {
+  return (long)(now - at) >= 0;
+}
+
+static void countUp(uint16_t& counter) {
+  if (counter != 0xFFFF) counter++;
+}
+
+static void readTask(uint8_t index, Task& t) {
+  memcpy_P(&t, &schedTasks[index], sizeof(t));
+}
+
+void schedulerBegin(const Task* tasks, TaskState* state, uint8_t count) {
+  schedTasks = tasks;
+  schedState = state;
+  schedCount = count;
+
+  unsigned long now = halMillis();
+  for (uint8_t i = 0; i < schedCount; i++) {
+    schedState[i].nextRelease = now;
+  }
+  schedulerResetStats();
+}
+
+void schedulerRun() {
+  for (uint8_t i = 0; i < schedCount; i++) {
+    TaskState& s = schedState[i];
+
+    unsigned long now = halMillis();
+    if (!isDue(now, s.nextRelease)) continue;
+
+    Task t;
+    readTask(i, t);
+
+    unsigned long released = s.nextRelease;
+    t.run();
+    countUp(s.runs);
+
+    unsigned long finished = halMillis();
+    unsigned long latency = finished - released;
+    if (latency > 0xFFFF) latency = 0xFFFF;
+    if (latency > s.worstLatencyMs) s.worstLatencyMs = latency;
+    if (latency > t.deadlineMs) countUp(s.overruns);
+
+    if (t.periodMs == 0) {
+      // "every loop" tasks are simply due again on the next pass
+      s.nextRelease = finished;
+    } else {
+      // Keep a fixed rate (no drift), but if we fell a whole period behind
+      // we skip the missed releases instead of running the task back to back.
+      s.nextRelease = released + t.periodMs;
+      if (isDue(finished, s.nextRelease + t.periodMs)) {
+        s.nextRelease = finished + t.periodMs;
+      }
+    }
+  }
+}
+
+bool schedulerDue() {
+  unsigned long now = halMillis();
+  for (uint8_t i = 0; i < schedCount; i++) {
+    Task t;
+    readTask(i, t);
+    if (t.periodMs != 0 && isDue(now, schedState[i].nextRelease)) return true;
+  }
+  return false;
+}
+
+void schedulerKick(uint8_t index) {
+  if (index >= schedCount) return;   // before schedulerBegin() everything is due anyway
+  schedState[index].nextRelease = halMillis();
+}
+
+bool schedulerReportLine(Print& out, uint8_t index) {
+  if (index >= schedCount) return false;
+
+  Task t;
+  readTask(index, t);
+  const TaskState& s = schedState[index];
+  out.print(F("SCHED task="));
+  out.print((const __FlashStringHelper*)t.name);
+  out.print(F(" period="));
+  out.print(t.periodMs);
+  out.print(F(" runs="));
+  out.print(s.runs);
+  out.print(F(" overruns="));
+  out.print(s.overruns);
+  out.print(F(" worst_ms="));
+  out.println(s.worstLatencyMs);
+  return true;
+}
+
+void schedulerResetStats() {
+  for (uint8_t i = 0; i < schedCount; i++) {
+    schedState[i].runs = 0;
+    schedState[i].overruns = 0;
+    schedState[i].worstLatencyMs = 0;
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= COOPERATIVE TASK SCHEDULER =================
+// Small run-to-completion scheduler that replaces the old fixed delay(200) in loop().
+// Every task has its own period and deadline:
+// - periodMs   = how often the task is released (0 = every pass of loop())
+// - deadlineMs = how long a release may take (waiting + running) before it counts as an overrun
+// Tasks must never block; they do a small piece of work and return.
+
+typedef void (*TaskFn)();
+
+// The task table never changes, so it lives in flash (PROGMEM) like the other fixed tables.
+struct Task {
+  const char* name;   // in flash (PROGMEM), only used for the SCHED? report
+  TaskFn run;
+  uint16_t periodMs;
+  uint16_t deadlineMs;
+};
+
+// Bookkeeping for one task, the only part in RAM (filled in by the scheduler).
+// The counters are 16 bit to keep it small on the Uno; they stop at 65535
+// instead of wrapping, SCHED! starts them over.
+struct TaskState {
+  unsigned long nextRelease;
+  uint16_t runs;
+  uint16_t overruns;
+  uint16_t worstLatencyMs;   // worst release -> finish time seen so far
+};
+
+// Helper so the task table in main.cpp stays readable
+#define SCHED_TASK(name, fn, periodMs, deadlineMs) { name, fn, periodMs, deadlineMs }
+
+// Registers the task table (in flash) and its state array (count entries each)
+// and releases every task immediately.
+void schedulerBegin(const Task* tasks, TaskState* state, uint8_t count);
+
+// Runs every task that is due, in table order (earlier entries have higher priority).
+void schedulerRun();
+
+// True if a task with a period is due right now (the "every pass" tasks don't count).
+// Used to decide whether the CPU may sleep until the next tick.
+bool schedulerDue();
+
+// Releases a task right now instead of waiting for its next period
+// (used when something happens that the task should react to quickly).
+void schedulerKick(uint8_t index);
+
+// Prints the "SCHED" line for task number index (runs, overruns and worst latency).
+// Returns false when index is past the last task. Fits the ReportLineFn shape in serial_out.h.
+bool schedulerReportLine(Print& out, uint8_t index);
+
+// Clears run/overrun counters without touching the timing.
+void schedulerResetStats();
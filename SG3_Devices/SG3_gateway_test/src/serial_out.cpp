@@ -0,0 +1,177 @@
+#include "serial_out.h"
+
+SerialOut serialOut;
+
+static uint8_t urgentBuf[OUT_URGENT_SIZE];
+static uint8_t debugBuf[OUT_DEBUG_SIZE];
+
+// Ring layout: every message is stored as [length byte][bytes...]
+
+void SerialOut::begin(StateRenderFn fn) {
+  urgent.buf = urgentBuf;
+  urgent.size = OUT_URGENT_SIZE;
+  debug.buf = debugBuf;
+  debug.size = OUT_DEBUG_SIZE;
+
+  Ring* rings[] = { &urgent, &debug };
+  for (uint8_t i = 0; i < 2; i++) {
+    rings[i]->tail = 0;
+    rings[i]->head = 0;
+    rings[i]->writeHead = 0;
+    rings[i]->overflow = false;
+  }
+
+  writing = nullptr;
+  stateLen = 0;
+  stateRendering = false;
+  statePending = false;
+  renderState = fn;
+  report = nullptr;
+  reportIndex = 0;
+  sendingRing = nullptr;
+  sendLeft = 0;
+  statePos = 0;
+  resetStats();
+}
+
+void SerialOut::resetStats() {
+  st.bytesSent = 0;
+  st.droppedUrgent = 0;
+  st.droppedDebug = 0;
+  st.mergedState = 0;
+  st.truncatedState = 0;
+}
+
+uint8_t SerialOut::ringUsed(const Ring& r, uint8_t head) const {
+  return (uint8_t)((head + r.size - r.tail) % r.size);
+}
+
+void SerialOut::ringPush(Ring& r, uint8_t c) {
+  // One slot always stays free so head == tail means "empty"
+  uint8_t next = (uint8_t)((r.writeHead + 1) % r.size);
+  if (next == r.tail) {
+    r.overflow = true;
+    return;
+  }
+  r.buf[r.writeHead] = c;
+  r.writeHead = next;
+}
+
+void SerialOut::beginMessage(OutPriority prio) {
+  writing = (prio == OUT_DEBUG) ? &debug : &urgent;
+  writing->writeHead = writing->head;
+  writing->overflow = false;
+  ringPush(*writing, 0);   // length, filled in by endMessage()
+}
+
+bool SerialOut::endMessage() {
+  Ring* r = writing;
+  writing = nullptr;
+  if (r == nullptr) return false;
+
+  uint8_t len = (uint8_t)(ringUsed(*r, r->writeHead) - ringUsed(*r, r->head) - 1);
+  if (r->overflow || len == 0) {
+    // Roll back: the partial message never becomes visible to pump()
+    r->writeHead = r->head;
+    if (r->overflow) {
+      if (r == &urgent) st.droppedUrgent++;
+      else              st.droppedDebug++;
+    }
+    return false;
+  }
+
+  r->buf[r->head] = len;
+  r->head = r->writeHead;
+  return true;
+}
+
+size_t SerialOut::write(uint8_t c) {
+  if (stateRendering) {
+    if (stateLen < OUT_STATE_SIZE) stateBuf[stateLen++] = c;
+    else                           st.truncatedState++;
+    return 1;
+  }
+  if (writing == nullptr) return 0;   // printing outside begin/endMessage is a bug, ignore it
+  ringPush(*writing, c);
+  return 1;
+}
+
+void SerialOut::postState() {
+  if (statePending) st.mergedState++;
+  statePending = true;
+}
+
+void SerialOut::startReport(ReportLineFn fn) {
+  report = fn;
+  reportIndex = 0;
+}
+
+// Picks the next message by priority. Returns false if there is nothing to send.
+bool SerialOut::startNextMessage() {
+  if (urgent.tail != urgent.head) {
+    sendingRing = &urgent;
+  }
+  else if (statePending && renderState != nullptr) {
+    // Render the state right now, so what goes out is always the newest state
+    stateLen = 0;
+    stateRendering = true;
+    renderState(*this);
+    stateRendering = false;
+    statePending = false;
+    sendingRing = nullptr;
+    statePos = 0;
+    sendLeft = stateLen;
+    return sendLeft > 0;
+  }
+  else if (debug.tail != debug.head) {
+    sendingRing = &debug;
+  }
+  else {
+    return false;
+  }
+
+  sendLeft = sendingRing->buf[sendingRing->tail];
+  sendingRing->tail = (uint8_t)((sendingRing->tail + 1) % sendingRing->size);
+  return true;
+}
+
+bool SerialOut::wantsToSend() const {
+  if (halSerialAvailableForWrite() <= 0) return false;
+  return sendLeft > 0 || statePending || report != nullptr ||
+         urgent.tail != urgent.head || debug.tail != debug.head;
+}
+
+void SerialOut::pump() {
+  // Produce the next report line when the debug ring has room for it
+  if (report != nullptr && (uint8_t)(debug.size - 1 - ringUsed(debug, debug.head)) >= OUT_REPORT_LINE_MAX) {
+    ReportLineFn fn = report;
+    beginMessage(OUT_DEBUG);
+    bool more = fn(*this, reportIndex++);
+    endMessage();
+    if (!more) report = nullptr;
+  }
+
+  int room = halSerialAvailableForWrite();
+  while (room > 0) {
+    if (sendLeft == 0 && !startNextMessage()) return;
+
+    if (sendingRing == nullptr) {
+      uint8_t n = sendLeft;
+      if (n > room) n = (uint8_t)room;
+      halSerialWrite(stateBuf + statePos, n);
+      statePos += n;
+      sendLeft -= n;
+      room -= n;
+      st.bytesSent += n;
+    } else {
+      Ring& r = *sendingRing;
+      while (room > 0 && sendLeft > 0) {
+        halSerialWrite(&r.buf[r.tail], 1);
+        r.tail = (uint8_t)((r.tail + 1) % r.size);
+        sendLeft--;
+        room--;
+        st.bytesSent++;
+      }
+    }
+  }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= OUTBOUND SERIAL QUEUE =================
+// Everything the firmware sends to the gateway goes through here instead of Serial.print().
+// serialOutPump() hands the UART only as many bytes as fit in its TX buffer right now
+// (Serial.availableForWrite()), so printing can never block loop() no matter how slow the link is.
+//
+// Three priorities, a message is always sent completely before the next one starts:
+//   OUT_URGENT  command answers and safety events (ring buffer, dropped if full)
+//   OUT_STATE   the STATE line / frame. There is only ONE slot: serialOutPostState() just marks
+//               "state must go out" and the state is rendered when the UART is ready for it,
+//               so a state update that is still waiting is replaced by the newer one (merged).
+//   OUT_DEBUG   reports and diagnostics (ring buffer, dropped if full)
+//
+// Usage:
+//   serialOut.beginMessage(OUT_URGENT);
+//   serialOut.print("TLM binary");
+//   serialOut.endMessage();
+
+enum OutPriority { OUT_URGENT, OUT_STATE, OUT_DEBUG };
+
+const uint8_t OUT_URGENT_SIZE = 64;
+const uint8_t OUT_DEBUG_SIZE = 96;       // one report line at a time (they go out one by one anyway)
+const uint8_t OUT_STATE_SIZE = 136;      // longest ASCII STATE line + CRLF
+const uint8_t OUT_REPORT_LINE_MAX = 80;  // room a report line needs in the debug ring (TXQ is the longest)
+
+// Writes the current state (ASCII line or binary frame) into out.
+typedef void (*StateRenderFn)(Print& out);
+
+// Writes report line number index into out; returns false when there are no more lines.
+typedef bool (*ReportLineFn)(Print& out, uint8_t index);
+
+struct SerialOutStats {
+  unsigned long bytesSent;
+  unsigned long droppedUrgent;
+  unsigned long droppedDebug;
+  unsigned long mergedState;
+  unsigned long truncatedState;
+};
+
+class SerialOut : public Print {
+public:
+  void begin(StateRenderFn renderState);
+
+  // Queue one URGENT or DEBUG message. Everything printed in between belongs to it.
+  // endMessage() returns false if the message did not fit and was dropped.
+  void beginMessage(OutPriority prio);
+  bool endMessage();
+
+  // The state changed and should go out; replaces a state update that is still waiting.
+  void postState();
+
+  // Long reports (several lines) are produced one line at a time whenever the
+  // debug ring has room, instead of being pushed in one go and mostly dropped.
+  void startReport(ReportLineFn fn);
+
+  // Moves queued bytes to the UART without blocking. Call every pass of loop().
+  void pump();
+
+  // True if something is waiting that the UART could take right now
+  bool wantsToSend() const;
+
+  const SerialOutStats& stats() const { return st; }
+  void resetStats();
+
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+private:
+  struct Ring {
+    uint8_t* buf;
+    uint8_t size;
+    uint8_t tail;        // next byte to send
+    uint8_t head;        // end of committed messages
+    uint8_t writeHead;   // end of the message being written
+    bool overflow;
+  };
+
+  void ringPush(Ring& r, uint8_t c);
+  uint8_t ringUsed(const Ring& r, uint8_t head) const;
+  bool startNextMessage();
+
+  Ring urgent;
+  Ring debug;
+  Ring* writing;         // ring the current beginMessage() goes into (null = rendering state)
+
+  uint8_t stateBuf[OUT_STATE_SIZE];
+  uint8_t stateLen;
+  bool stateRendering;
+  bool statePending;
+  StateRenderFn renderState;
+
+  ReportLineFn report;
+  uint8_t reportIndex;
+
+  // Message currently going out
+  Ring* sendingRing;     // null = sending stateBuf
+  uint8_t sendLeft;
+  uint8_t statePos;
+
+  SerialOutStats st;
+};
+
+extern SerialOut serialOut;
@@ -0,0 +1,124 @@
+#include "servo_motion.h"
+
+// Start time of the last move of any servo (for startOffsetMs)
+static unsigned long lastStartAt = 0;
+static bool anyStarted = false;
+
+// Longest step one update may take, so a slow pass doesn't turn into a jump
+static const unsigned long SERVO_MAX_DT_MS = 50;
+
+// Below this speed the deceleration ramp would crawl; the last bit is done at this speed
+static const int32_t SERVO_MIN_SPEED = 1000;   // 10 deg/s
+
+static void writeAngle(ServoAxis& s) {
+  int16_t angle = (int16_t)((s.pos + 50) / 100);
+  if (angle == s.written) return;
+  halServoWrite(s.id, angle);
+  s.written = angle;
+  s.writes++;
+}
+
+static void attach(ServoAxis& s) {
+  if (s.attached) return;
+  // Position first, so the first pulse already has the right width
+  s.written = -1;
+  writeAngle(s);
+  halServoAttach(s.id, s.pin);
+  s.attached = true;
+}
+
+void servoInit(ServoAxis& s, uint8_t id, uint8_t pin, const ServoProfile& profile, int angle) {
+  s.id = id;
+  s.pin = pin;
+  s.profile = &profile;
+  s.pos = (int32_t)angle * 100;
+  s.vel = 0;
+  s.target = s.pos;
+  s.written = -1;
+  s.attached = false;
+  s.waiting = false;
+  s.startAt = 0;
+  s.settledAt = 0;
+  s.lastUpdate = 0;
+  s.writes = 0;
+}
+
+void servoSync(ServoAxis& s, unsigned long now) {
+  attach(s);
+  s.settledAt = now;
+  s.lastUpdate = now;
+}
+
+bool servoMoving(const ServoAxis& s) {
+  return s.waiting || s.pos != s.target;
+}
+
+void servoMoveTo(ServoAxis& s, int angle, unsigned long now) {
+  int32_t target = (int32_t)angle * 100;
+  if (target == s.target) return;
+  s.target = target;
+
+  // Already on its way (or about to be): just steer to the new target
+  if (s.vel != 0 || s.waiting) return;
+
+  unsigned long start = now;
+  if (anyStarted && (long)(lastStartAt + s.profile->startOffsetMs - now) > 0) {
+    start = lastStartAt + s.profile->startOffsetMs;
+  }
+  lastStartAt = start;
+  anyStarted = true;
+  s.startAt = start;
+  s.waiting = true;
+}
+
+void servoUpdate(ServoAxis& s, unsigned long now) {
+  unsigned long dt = now - s.lastUpdate;
+  s.lastUpdate = now;
+  if (dt > SERVO_MAX_DT_MS) dt = SERVO_MAX_DT_MS;
+
+  if (s.waiting) {
+    if ((long)(now - s.startAt) < 0) return;
+    s.waiting = false;
+    attach(s);
+    dt = 0;
+  }
+
+  if (s.pos == s.target) {
+    // Arrived: let go once it has settled
+    if (s.attached && now - s.settledAt >= s.profile->settleMs) {
+      halServoDetach(s.id);
+      s.attached = false;
+    }
+    return;
+  }
+  if (!s.attached) attach(s);
+
+  const int32_t vmax = (int32_t)s.profile->speedDegS * 100;
+  const int32_t accel = (int32_t)s.profile->accelDegS2 * 100;
+  int32_t dist = s.target - s.pos;
+  int32_t dir = dist > 0 ? 1 : -1;
+  int32_t left = dist * dir;
+  int32_t v = s.vel * dir;   // speed towards the target (negative = still going the other way)
+  int32_t dv = accel * (int32_t)dt / 1000;
+
+  // Distance needed to stop from the current speed: v^2 / 2a
+  int32_t stopDist = v > 0 ? v / 2 * v / accel : 0;
+
+  if (v < 0 || left > stopDist) {
+    v += dv;
+    if (v > vmax) v = vmax;
+  } else {
+    v -= dv;
+    if (v < SERVO_MIN_SPEED) v = SERVO_MIN_SPEED;
+  }
+
+  if (v > 0 && v * (int32_t)dt / 1000 >= left) {
+    s.pos = s.target;
+    s.vel = 0;
+    s.settledAt = now;
+  } else {
+    s.pos += v * (int32_t)dt / 1000 * dir;
+    s.vel = v * dir;
+  }
+  writeAngle(s);
+}
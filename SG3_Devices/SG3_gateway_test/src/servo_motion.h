@@ -0,0 +1,53 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= SERVO MOTION =================
+// The door and window servos used to get write(0) / write(150) on every pass of loop() and
+// jump straight to the new angle, pulling a big current spike from the batteries.
+// Now every servo follows a trapezoidal profile: it speeds up with accelDegS2 to speedDegS,
+// and slows down again so it stops exactly at the target.
+// - The servo is only written when its whole-degree angle changes.
+// - Once it has reached the target and settleMs passed it is detached: no holding current,
+//   no pulses (so no Timer1 jitter either). The gear holds the door / window in place.
+// - A move only starts startOffsetMs after the previous one started (any servo), so door and
+//   window never hit their peak current together.
+
+struct ServoProfile {
+  uint16_t speedDegS;       // top speed
+  uint16_t accelDegS2;      // acceleration and deceleration
+  uint16_t settleMs;        // stays attached this long after arriving
+  uint16_t startOffsetMs;   // gap between the starts of two moves
+};
+
+struct ServoAxis {
+  uint8_t id;               // HAL servo id
+  uint8_t pin;
+  const ServoProfile* profile;
+  int32_t pos;              // 1/100 degree
+  int32_t vel;              // 1/100 degree per second, signed
+  int32_t target;           // 1/100 degree
+  int16_t written;          // last angle sent to the servo (-1 = none)
+  bool attached;
+  bool waiting;             // move requested, start offset not over yet
+  unsigned long startAt;
+  unsigned long settledAt;
+  unsigned long lastUpdate;
+  unsigned long writes;     // number of halServoWrite() calls
+};
+
+// Sets up an axis that is assumed to stand at angle (not attached yet)
+void servoInit(ServoAxis& s, uint8_t id, uint8_t pin, const ServoProfile& profile, int angle);
+
+// Attaches right now at the assumed position and lets it detach after settleMs.
+// Used at boot, where we don't know where the horn really is.
+void servoSync(ServoAxis& s, unsigned long now);
+
+// New target angle. Does nothing if it is already the target.
+void servoMoveTo(ServoAxis& s, int angle, unsigned long now);
+
+// Advances the profile. Call every pass.
+void servoUpdate(ServoAxis& s, unsigned long now);
+
+bool servoMoving(const ServoAxis& s);
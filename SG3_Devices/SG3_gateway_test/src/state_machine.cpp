@@ -0,0 +1,61 @@
+#include "state_machine.h"
+#include "serial_out.h"
+
+void fsmBegin(Fsm& fsm, const FsmDef& def) {
+  fsm.def = &def;
+  fsm.state = 0;
+  fsm.now = halMillis();
+  fsm.timerEnd = fsm.now;
+}
+
+bool fsmTimeUp(const Fsm& fsm) {
+  return (long)(fsm.now - fsm.timerEnd) >= 0;
+}
+
+static void printStateName(Print& out, const FsmDef& def, uint8_t state) {
+  out.print((const __FlashStringHelper*)(def.stateNames + (uint16_t)state * def.nameWidth));
+}
+
+static void readDef(const Fsm& fsm, FsmDef& def) {
+  memcpy_P(&def, fsm.def, sizeof(def));
+}
+
+static void reportTransition(const Fsm& fsm, uint8_t from) {
+  FsmDef def;
+  readDef(fsm, def);
+  serialOut.beginMessage(OUT_URGENT);
+  serialOut.print(F("EV "));
+  serialOut.print((const __FlashStringHelper*)def.name);
+  serialOut.print(' ');
+  printStateName(serialOut, def, from);
+  serialOut.print('>');
+  printStateName(serialOut, def, fsm.state);
+  serialOut.print(' ');
+  serialOut.println(fsm.now);
+  serialOut.endMessage();
+}
+
+bool fsmStep(Fsm& fsm, unsigned long now) {
+  FsmDef def;
+  readDef(fsm, def);
+  fsm.now = now;
+
+  uint8_t first = pgm_read_byte(&def.firstRow[fsm.state]);
+  uint8_t last = pgm_read_byte(&def.firstRow[fsm.state + 1]);
+
+  for (uint8_t i = first; i < last; i++) {
+    FsmRow row;
+    memcpy_P(&row, &def.rows[i], sizeof(row));
+
+    if (row.guard != nullptr && !row.guard(fsm)) continue;
+
+    uint8_t from = fsm.state;
+    if (row.action != nullptr) row.action();
+    fsm.state = row.next;
+    fsm.timerEnd = now + row.durationMs;
+
+    if (fsm.state != from) reportTransition(fsm, from);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "hal.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= TABLE-DRIVEN STATE MACHINES =================
+// A sequence like the gas alarm or the rain alert is described by a table of rows in flash:
+//
+//   { state, guard, action, durationMs, next }
+//
+// Once per tick fsmStep() looks only at the rows of the current state, in table order.
+// The first row whose guard is true fires: its action runs, the machine moves to next and
+// the timer of next is set to durationMs (guards check it with fsmTimeUp()).
+// The time is read once per tick and handed in, so every guard sees the same "now".
+//
+// Rows of one state must be next to each other; firstRow[s] is the index of the first row
+// of state s, firstRow[stateCount] the number of rows. Each state has a few rows at most,
+// so one step costs the same whatever state the machine is in.
+//
+// Every change of state (not a state re-entering itself) goes out on the serial link as
+//   EV <machine> <from>><to> <millis>        e.g. "EV gas alert>open_vent 9200"
+
+struct Fsm;
+
+typedef bool (*FsmGuard)(const Fsm& fsm);   // nullptr in a row = always true
+typedef void (*FsmAction)();                // nullptr in a row = nothing to do
+
+struct FsmRow {
+  uint8_t state;
+  FsmGuard guard;
+  FsmAction action;
+  uint16_t durationMs;
+  uint8_t next;
+};
+
+// The definition itself is in flash too (PROGMEM), so a machine costs only its Fsm in RAM
+struct FsmDef {
+  const char* name;         // PROGMEM
+  const char* stateNames;   // PROGMEM, stateCount names of nameWidth chars each (NUL terminated)
+  uint8_t nameWidth;
+  const FsmRow* rows;       // PROGMEM
+  const uint8_t* firstRow;  // PROGMEM, stateCount + 1 entries
+  uint8_t stateCount;
+};
+
+struct Fsm {
+  const FsmDef* def;        // PROGMEM
+  uint8_t state;
+  unsigned long timerEnd;
+  unsigned long now;        // time of the step in progress
+};
+
+// Starts in state 0 with the timer already run out (def must be in PROGMEM)
+void fsmBegin(Fsm& fsm, const FsmDef& def);
+
+// Evaluates the current state once. Returns true if a row fired.
+bool fsmStep(Fsm& fsm, unsigned long now);
+
+// Guard: the timer set by the last transition has run out
+bool fsmTimeUp(const Fsm& fsm);
@@ -0,0 +1,58 @@
+#include "telemetry_frame.h"
+
+uint8_t crc8Update(uint8_t crc, uint8_t data) {
+  // Bitwise instead of a 256-byte table: flash is more precious than a few cycles per byte here
+  crc ^= data;
+  for (uint8_t b = 0; b < 8; b++) {
+    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+uint8_t crc8(const uint8_t* data, uint8_t len) {
+  uint8_t crc = 0x00;
+  for (uint8_t i = 0; i < len; i++) crc = crc8Update(crc, data[i]);
+  return crc;
+}
+
+uint8_t cobsEncode(const uint8_t* in, uint8_t len, uint8_t* out) {
+  uint8_t codeIdx = 0;   // where the current block's length byte goes
+  uint8_t code = 1;
+  uint8_t o = 1;
+
+  for (uint8_t i = 0; i < len; i++) {
+    if (in[i] == 0) {
+      out[codeIdx] = code;
+      codeIdx = o++;
+      code = 1;
+    } else {
+      out[o++] = in[i];
+      code++;
+    }
+  }
+  out[codeIdx] = code;
+  return o;
+}
+
+static uint16_t clamp10(uint16_t v) {
+  return v > 1023 ? 1023 : v;
+}
+
+uint8_t buildStateFrame(const StateSnapshot& s, uint8_t seq, uint8_t* out) {
+  uint16_t gas = clamp10(s.gas);
+  uint16_t steam = clamp10(s.steam);
+
+  uint8_t payload[STATE_PAYLOAD_LEN];
+  payload[0] = STATE_FRAME_TYPE;
+  payload[1] = seq;
+  payload[2] = s.bits;
+  payload[3] = (uint8_t)(gas >> 2);
+  payload[4] = (uint8_t)(((gas & 0x03) << 6) | (steam >> 4));
+  payload[5] = (uint8_t)((steam & 0x0F) << 4);
+  payload[6] = crc8(payload, STATE_PAYLOAD_LEN - 1);
+
+  out[0] = 0x00;
+  uint8_t n = cobsEncode(payload, STATE_PAYLOAD_LEN, out + 1);
+  out[1 + n] = 0x00;
+  return n + 2;
+}
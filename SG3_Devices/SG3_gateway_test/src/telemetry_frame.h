@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// ================= BINARY STATE FRAME =================
+// Opt-in compact alternative to the ASCII "STATE door=open window=close ..." line
+// (~150 bytes -> 10 bytes on the wire). The gateway turns it on with "T:1" and back off with "T:0".
+//
+// Payload (7 bytes, before framing):
+//   [0] type      STATE_FRAME_TYPE
+//   [1] seq       increments on every frame (lets the gateway spot lost frames)
+//   [2] actuators bitfield, see STATE_BIT_*
+//   [3..5] sensors gas (10 bit) | steam (10 bit) | 4 spare bits, big-endian bit order
+//   [6] crc8      CRC-8 (poly 0x07, init 0x00) over bytes 0..5
+//
+// On the wire: 0x00 <COBS(payload)> 0x00
+// COBS removes every 0x00 from the payload, so 0x00 only ever appears as a delimiter and the
+// gateway can pick frames out of a stream that still carries normal ASCII lines.
+// Plain C++ (no Arduino.h) so the gateway decoder can be checked against it on a PC.
+
+const uint8_t STATE_FRAME_TYPE = 0x53;   // 'S', version 1
+const uint8_t STATE_PAYLOAD_LEN = 7;
+const uint8_t STATE_FRAME_MAX = STATE_PAYLOAD_LEN + 3;   // leading 0x00 + COBS overhead byte + trailing 0x00
+
+// The same bits (without motion) go the other way in the S=<hex> command, which sets every
+// actuator at once (see applyStateFrame() in main.cpp).
+enum StateBit {
+  STATE_BIT_DOOR         = 1 << 0,
+  STATE_BIT_WINDOW       = 1 << 1,
+  STATE_BIT_BUZZER       = 1 << 2,
+  STATE_BIT_FAN_INA      = 1 << 3,
+  STATE_BIT_FAN_INB      = 1 << 4,
+  STATE_BIT_WHITE_LIGHT  = 1 << 5,
+  STATE_BIT_ORANGE_LIGHT = 1 << 6,
+  STATE_BIT_MOTION       = 1 << 7,
+};
+
+struct StateSnapshot {
+  uint8_t bits;     // StateBit flags
+  uint16_t gas;     // 0..1023
+  uint16_t steam;   // 0..1023
+};
+
+uint8_t crc8(const uint8_t* data, uint8_t len);
+uint8_t crc8Update(uint8_t crc, uint8_t data);   // one more byte, for data that is not in RAM
+
+// Encodes len bytes (len < 254) into out, which needs room for len + 1 bytes.
+// Returns the encoded length. Does not add the 0x00 delimiters.
+uint8_t cobsEncode(const uint8_t* in, uint8_t len, uint8_t* out);
+
+// Builds a complete delimited frame into out (STATE_FRAME_MAX bytes). Returns its length.
+uint8_t buildStateFrame(const StateSnapshot& s, uint8_t seq, uint8_t* out);
@@ -20,6 +20,8 @@ if not os.path.isabs(SERVICE_ACCOUNT_PATH):
     SERVICE_ACCOUNT_PATH = os.path.join(PROJECT_ROOT, SERVICE_ACCOUNT_PATH)
     
 WATCH_DOC = os.getenv("WATCH_DOC")
+# "ascii" = STATE lines (default), "binary" = compact frames (firmware T:1)
+TELEMETRY_MODE = os.getenv("TELEMETRY_MODE", "ascii").strip().lower()
 
 cred = credentials.Certificate(SERVICE_ACCOUNT_PATH)
 firebase_admin.initialize_app(cred)
@@ -39,6 +41,7 @@ last_fan_ina = None
 last_fan_inb = None
 last_white_light = None
 last_orange_light = None
+board_synced = False    # the first snapshot brings the board to the document state (S frame)
 
 def norm(v):
     if v is None: return None
@@ -93,6 +96,75 @@ def parse_state_line(line):
         state[key.strip().lower()] = value.strip().lower()
     return state
 
+# Binary STATE frame (see SG3_gateway_test/src/telemetry_frame.h)
+STATE_FRAME_TYPE = 0x53
+STATE_PAYLOAD_LEN = 7
+STATE_BITS = (
+    ("door", "open", "close"),
+    ("window", "open", "close"),
+    ("buzzer", "on", "off"),
+    ("fan_ina", "on", "off"),
+    ("fan_inb", "on", "off"),
+    ("white_light", "on", "off"),
+    ("orange_light", "on", "off"),
+)
+
+def crc8(data):
+    """CRC-8, poly 0x07, init 0x00 (same as the firmware)."""
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+def cobs_decode(data):
+    """Undo COBS framing. Returns None if the block structure is broken."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out.extend(data[i + 1:i + code])
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+def parse_state_frame(frame):
+    """Parse a binary STATE frame (COBS bytes without the 0x00 delimiters) into the
+    same dict parse_state_line() returns. Returns {} for anything that doesn't check out."""
+    payload = cobs_decode(frame)
+    if payload is None or len(payload) != STATE_PAYLOAD_LEN:
+        return {}
+    if payload[0] != STATE_FRAME_TYPE or crc8(payload[:-1]) != payload[-1]:
+        return {}
+
+    bits = payload[2]
+    state = {"seq": str(payload[1])}
+    for i, (key, on_value, off_value) in enumerate(STATE_BITS):
+        state[key] = on_value if bits & (1 << i) else off_value
+    state["motion"] = "1" if bits & 0x80 else "0"
+
+    gas = (payload[3] << 2) | (payload[4] >> 6)
+    steam = ((payload[4] & 0x3F) << 4) | (payload[5] >> 4)
+    state["gas"] = str(gas)
+    state["steam"] = str(steam)
+    return state
+
+def state_set_frame(desired):
+    """S=<hex> that sets every actuator at once (same bits as the STATE frame), or None if
+    the document doesn't say what one of them should be."""
+    bits = 0
+    for i, (key, on_value, _) in enumerate(STATE_BITS):
+        value = desired.get(key)
+        if value is None:
+            return None
+        if value == on_value:
+            bits |= 1 << i
+    return f"S={bits:02X}"
+
 def sync_arduino_to_firestore(state):
     """Write Arduino physical state to Firestore (button presses, sensors)."""
     global last_door, last_window, last_buzzer
@@ -182,28 +254,43 @@ def sync_arduino_to_firestore(state):
         print("Failed to sync Arduino state to Firebase:", exc)
 
 def arduino_listener():
-    """Background thread: read STATE lines from Arduino and update Firestore."""
+    """Background thread: read STATE lines/frames from Arduino and update Firestore."""
     while True:
         try:
-            line = sc.read_line()
+            msg = sc.read_message()
         except Exception as exc:
             print("Serial read error:", exc)
             time.sleep(1)
             continue
 
-        if not line:
+        if not msg:
             continue
 
-        state = parse_state_line(line)
+        kind, data = msg
+        if kind == "frame":
+            state = parse_state_frame(data)
+        else:
+            state = parse_state_line(data)
         if state:
             sync_arduino_to_firestore(state)
 
+def send(cmd):
+    """Send a command and wait for the board's ACK (retries included, see SerialClient.send_command)."""
+    answer = sc.send_command(cmd)
+    if answer is None:
+        print("No answer from the board for", cmd)
+    elif not answer["ok"]:
+        print(f"Board refused {cmd}: {answer['reason']}")
+    return answer
+
 def on_snapshot(doc_snapshot, changes, read_time):
     global last_fan, last_door, last_window, last_msg, last_buzzer, last_fan_ina, last_fan_inb, last_white_light, last_orange_light
+    global board_synced
 
     with state_lock:
         for doc in doc_snapshot:
             data = doc.to_dict() or {}
+            scene = []   # actuator commands of this snapshot, sent as one batch
 
             fan = to_on_off(data.get("fan"))     # "on"/"off" (legacy, may not be used)
 
@@ -228,39 +315,53 @@ def on_snapshot(doc_snapshot, changes, read_time):
             if raw_window is not None and window is None:
                 print("Ignored unsupported window value:", raw_window)
 
+            # First snapshot: one S frame sets the whole board, no need to know what it did before.
+            # If the document doesn't cover every actuator, only later changes are sent (as before).
+            if not board_synced:
+                board_synced = True
+                frame = state_set_frame({"door": door, "window": window, "buzzer": buzzer,
+                                         "fan_ina": fan_ina, "fan_inb": fan_inb,
+                                         "white_light": white_light, "orange_light": orange_light})
+                answer = send(frame) if frame else None
+                if answer and answer["ok"]:
+                    last_door, last_window, last_buzzer = door, window, buzzer
+                    last_fan_ina, last_fan_inb = fan_ina, fan_inb
+                    last_white_light, last_orange_light = white_light, orange_light
+                    print("Board set to the document state:", frame)
+
             # FAN (legacy - for backward compatibility)
             if fan in ("on", "off"):
                 if last_fan is None:
                     last_fan = fan
                 elif fan != last_fan:
-                    sc.send_line("F")
+                    send("F:1" if fan == "on" else "F:0")
                     last_fan = fan
-                    print("Toggled FAN ->", fan)
+                    print("Set FAN ->", fan)
 
-            # FAN INA: toggle only when it CHANGES (ignore first snapshot)
+            # FAN INA: set explicit state only when it CHANGES (ignore first snapshot)
             if fan_ina in ("on", "off"):
                 if last_fan_ina is None:
                     last_fan_ina = fan_ina
                 elif fan_ina != last_fan_ina:
-                    sc.send_line("X")
+                    scene.append("X:1" if fan_ina == "on" else "X:0")
                     last_fan_ina = fan_ina
-                    print("Toggled FAN INA ->", fan_ina)
+                    print("Set FAN INA ->", fan_ina)
 
-            # FAN INB: toggle only when it CHANGES (ignore first snapshot)
+            # FAN INB: set explicit state only when it CHANGES (ignore first snapshot)
             if fan_inb in ("on", "off"):
                 if last_fan_inb is None:
                     last_fan_inb = fan_inb
                 elif fan_inb != last_fan_inb:
-                    sc.send_line("Y")
+                    scene.append("Y:1" if fan_inb == "on" else "Y:0")
                     last_fan_inb = fan_inb
-                    print("Toggled FAN INB ->", fan_inb)
+                    print("Set FAN INB ->", fan_inb)
 
             # DOOR: set explicit state only when it CHANGES (ignore first snapshot)
             if door in ("open", "close"):
                 if last_door is None:
                     last_door = door
                 elif door != last_door:
-                    sc.send_line("D:1" if door == "open" else "D:0")
+                    scene.append("D:1" if door == "open" else "D:0")
                     last_door = door
                     print("Set DOOR ->", door)
 
@@ -269,7 +370,7 @@ def on_snapshot(doc_snapshot, changes, read_time):
                 if last_window is None:
                     last_window = window
                 elif window != last_window:
-                    sc.send_line("N:1" if window == "open" else "N:0")
+                    scene.append("N:1" if window == "open" else "N:0")
                     last_window = window
                     print("Set WINDOW ->", window)
 
@@ -278,41 +379,52 @@ def on_snapshot(doc_snapshot, changes, read_time):
                 if last_buzzer is None:
                     last_buzzer = buzzer
                 elif buzzer != last_buzzer:
-                    sc.send_line("B:1" if buzzer == "on" else "B:0")
+                    scene.append("B:1" if buzzer == "on" else "B:0")
                     last_buzzer = buzzer
                     print("Set BUZZER ->", buzzer)
 
-            # WHITE LIGHT: toggle only when it CHANGES (ignore first snapshot)
+            # WHITE LIGHT: set explicit state only when it CHANGES (ignore first snapshot)
             if white_light in ("on", "off"):
                 if last_white_light is None:
                     last_white_light = white_light
                 elif white_light != last_white_light:
-                    sc.send_line("W")
+                    scene.append("W:1" if white_light == "on" else "W:0")
                     last_white_light = white_light
-                    print("Toggled WHITE LIGHT ->", white_light)
+                    print("Set WHITE LIGHT ->", white_light)
 
-            # ORANGE LIGHT: toggle only when it CHANGES (ignore first snapshot)
+            # ORANGE LIGHT: set explicit state only when it CHANGES (ignore first snapshot)
             if orange_light in ("on", "off"):
                 if last_orange_light is None:
                     last_orange_light = orange_light
                 elif orange_light != last_orange_light:
-                    sc.send_line("O")
+                    scene.append("O:1" if orange_light == "on" else "O:0")
                     last_orange_light = orange_light
-                    print("Toggled ORANGE LIGHT ->", orange_light)
+                    print("Set ORANGE LIGHT ->", orange_light)
+
+            # All changes of this snapshot in one line: the board applies them in the same pass,
+            # or none of them if one part is refused
+            if scene:
+                send(";".join(scene))
 
             # LCD demo (optional)
             if isinstance(msg, str):
                 if last_msg is None:
                     last_msg = msg
                 elif msg != last_msg:
-                    sc.send_line(f"M{msg[:16]}|")
+                    sc.send_text(msg)
                     last_msg = msg
                     print("LCD updated")
 
+# Ask the firmware for compact binary telemetry (it starts in ASCII after every reset)
+if TELEMETRY_MODE == "binary":
+    send("T:1")
+
 watch = doc_ref.on_snapshot(on_snapshot)
 listener_thread = threading.Thread(target=arduino_listener, daemon=True)
 listener_thread.start()
 
 print("Watching:", WATCH_DOC, "(bidirectional sync active)")
 while True:
-    time.sleep(10)
\ No newline at end of file
+    time.sleep(60)
+    if sc.latency:
+        print("Commands:", sc.latency_summary())
\ No newline at end of file
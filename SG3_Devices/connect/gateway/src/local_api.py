@@ -4,137 +4,151 @@ from serial_client import SerialClient
 app = Flask(__name__)
 sc = SerialClient()
 
+def command(line):
+    """Runs a command on the board; ok only once it was ACKed (see SerialClient.send_command).
+    ok = accepted: for the door and window the servo may still be moving for about a second."""
+    answer = sc.send_command(line)
+    if answer is None:
+        return jsonify(ok = False, error = "no answer"), 504
+    if not answer["ok"]:
+        return jsonify(ok = False, error = answer["reason"]), 400
+    return jsonify(ok = True, device_us = answer["device_us"], rtt_ms = round(answer["rtt_ms"], 1))
+
 @app.get("/health")
 def health():
     return jsonify(ok = True)
 
 @app.post("/fan/on")
 def fan_on():
-    sc.send_line("F:1")
-    return jsonify(ok = True)
+    return command("F:1")
 
 @app.post("/fan/off")
 def fan_off():
-    sc.send_line("F:0")
-    return jsonify(ok = True)
+    return command("F:0")
 
 @app.post("/fan/toggle")
 def fan():
-    sc.send_line("F")
-    return jsonify(ok = True)
+    return command("F")
 
 @app.post("/fan_ina/on")
 def fan_ina_on():
-    sc.send_line("X:1")
-    return jsonify(ok = True)
+    return command("X:1")
 
 @app.post("/fan_ina/off")
 def fan_ina_off():
-    sc.send_line("X:0")
-    return jsonify(ok = True)
+    return command("X:0")
 
 @app.post("/fan_ina/toggle")
 def fan_ina_toggle():
-    sc.send_line("X")
-    return jsonify(ok = True)
+    return command("X")
 
 @app.post("/fan_inb/on")
 def fan_inb_on():
-    sc.send_line("Y:1")
-    return jsonify(ok = True)
+    return command("Y:1")
 
 @app.post("/fan_inb/off")
 def fan_inb_off():
-    sc.send_line("Y:0")
-    return jsonify(ok = True)
+    return command("Y:0")
 
 @app.post("/fan_inb/toggle")
 def fan_inb_toggle():
-    sc.send_line("Y")
-    return jsonify(ok = True)
+    return command("Y")
 
 @app.post("/door/toggle")
 def door():
-    sc.send_line("D")
-    return jsonify(ok = True)
+    return command("D")
 
 @app.post("/door/close")
 def door_close():
-    sc.send_line("D:0")
-    return jsonify(ok = True)
+    return command("D:0")
 
 @app.post("/door/open")
 def door_open():
-    sc.send_line("D:1")
-    return jsonify(ok = True)
+    return command("D:1")
 
 @app.post("/window/toggle")
 def window_toggle():
-    sc.send_line("N")
-    return jsonify(ok = True)
+    return command("N")
 
 @app.post("/window/close")
 def window_close():
-    sc.send_line("N:0")
-    return jsonify(ok = True)
+    return command("N:0")
 
 @app.post("/window/open")
 def window_open():
-    sc.send_line("N:1")
-    return jsonify(ok = True)
+    return command("N:1")
 
 @app.post("/buzzer/on")
 def buzzer_on():
-    sc.send_line("B:1")
-    return jsonify(ok = True)
+    return command("B:1")
 
 @app.post("/buzzer/off")
 def buzzer_off():
-    sc.send_line("B:0")
-    return jsonify(ok = True)
+    return command("B:0")
 
 @app.post("/buzzer/toggle")
 def buzzer_toggle():
-    sc.send_line("B")
-    return jsonify(ok = True)
+    return command("B")
 
 @app.post("/white_light/on")
 def white_light_on():
-    sc.send_line("W:1")
-    return jsonify(ok = True)
+    return command("W:1")
 
 @app.post("/white_light/off")
 def white_light_off():
-    sc.send_line("W:0")
-    return jsonify(ok = True)
+    return command("W:0")
 
 @app.post("/white_light/toggle")
 def white_light_toggle():
-    sc.send_line("W")
-    return jsonify(ok = True)
+    return command("W")
 
 @app.post("/orange_light/on")
 def orange_light_on():
-    sc.send_line("O:1")
-    return jsonify(ok = True)
+    return command("O:1")
 
 @app.post("/orange_light/off")
 def orange_light_off():
-    sc.send_line("O:0")
-    return jsonify(ok = True)
+    return command("O:0")
 
 @app.post("/orange_light/toggle")
 def orange_light_toggle():
-    sc.send_line("O")
-    return jsonify(ok = True)
+    return command("O")
+
+@app.post("/scene")
+def scene():
+    """Several commands at once, e.g. {"commands": ["D:1", "N:1", "X", "W"]}.
+    The board runs all of them in the same pass, or none if one is refused."""
+    data = request.get_json(force=True)
+    cmds = [str(c).strip() for c in (data.get("commands") or []) if str(c).strip()]
+    if not cmds:
+        return jsonify(ok = False, error = "no commands"), 400
+    return command(";".join(cmds))
+
+# Bit order of the S frame, same as the binary STATE frame (see telemetry_frame.h)
+STATE_KEYS = ("door", "window", "buzzer", "fan_ina", "fan_inb", "white_light", "orange_light")
+
+@app.post("/state")
+def state():
+    """Whole actuator state in one write, e.g. {"door": "open", "window": "close", "buzzer": "off",
+    "fan_ina": "on", "fan_inb": "off", "white_light": "on", "orange_light": "off"}.
+    Every key is needed. The board sets all of them at once (S=<hex>), so sending it twice is harmless."""
+    data = request.get_json(force=True)
+    bits = 0
+    for i, key in enumerate(STATE_KEYS):
+        value = str(data.get(key, "")).strip().lower()
+        if value in ("open", "on", "1", "true"):
+            bits |= 1 << i
+        elif value not in ("close", "closed", "off", "0", "false"):
+            return jsonify(ok = False, error = f"{key} missing or unknown"), 400
+    return command(f"S={bits:02X}")
 
 @app.post("/lcd")
 def lcd():
     data = request.get_json(force=True)
     line1 = (data.get("line1") or "")[:16]
     line2 = (data.get("line2") or "")[:16]
-    sc.send_line(f"M{line1}|{line2}")
-    return jsonify(ok=True)
+    sc.send_text(line1, line2)   # LCD text gets no ACK, see SerialClient.send_text
+    return jsonify(ok = True)
 
 if __name__ == "__main__":
     app.run(host="0.0.0.0", port = 5050)
\ No newline at end of file
@@ -7,4 +7,4 @@ while True:
     cmd = input("> ").strip()
     if cmd == "q":
         break
-    sc.send_line(cmd)
\ No newline at end of file
+    print(sc.send_command(cmd))
\ No newline at end of file
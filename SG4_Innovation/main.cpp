@@ -1,3 +1,7 @@
+// NOTE: this sketch is not on the hardware abstraction layer (hal.h) and has no native
+// build; both only exist for SG3_Devices/SG3_gateway_test, the firmware the gateway runs.
+// It still talks to the pins, Servo, LCD and Serial directly and is kept as it was.
+
 #include <Arduino.h>
 #include <Wire.h> 
 #include <LiquidCrystal_I2C.h>
@@ -88,6 +92,8 @@ unsigned long startupStepUntil = 0;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // ========================= GAS ALERT LOGIC =========================
+// NOTE: still the hand-written ladder. The table-driven gas / rain engine (state_machine.h) lives in
+// SG3_Devices/SG3_gateway_test only; this sketch is not ported to it.
 // - For the FIRST 3 seconds after gas triggers, we ONLY do:
 //     * Show "!! GAS ALERT !!"
 //     * Play the basic alert buzzer
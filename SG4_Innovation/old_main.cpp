@@ -1,3 +1,7 @@
+// NOTE: this sketch is not on the hardware abstraction layer (hal.h) and has no native
+// build; both only exist for SG3_Devices/SG3_gateway_test, the firmware the gateway runs.
+// It still talks to the pins, Servo, LCD and Serial directly and is kept as it was.
+
 #include <Arduino.h>
 #include <Wire.h> 
 #include <LiquidCrystal_I2C.h>
@@ -208,6 +212,8 @@ if (steam > 100) {
 
 
   // --- 2. GAS ALARM TEST ---
+  // NOTE: plain if/else on purpose, the table-driven gas / rain engine (state_machine.h) lives in
+  // SG3_Devices/SG3_gateway_test only; this old sketch is not ported to it.
   // If gas (A0) is detected, beep the buzzer
   if (gas > gasThreshold) {
     digitalWrite(3, HIGH); // Beep ON